@@ -26,6 +26,23 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+/* 64-bit file offsets, also on 32-bit systems */
+#if !defined( _FILE_OFFSET_BITS )
+# define _FILE_OFFSET_BITS  64
+#endif /* if !defined( _FILE_OFFSET_BITS ) */
+
+/* Input directories are walked with dirent on POSIX systems */
+#if defined( __unix__ ) || defined( __APPLE__ )
+# define SIXPACK_DIRS
+#endif /* if defined( __unix__ ) || defined( __APPLE__ ) */
+
+/* For madvise, MADV_HUGEPAGE, lstat and fileno with -std=c90 */
+#if ( defined( SIXPACK_MMAP ) || defined( SIXPACK_DIRS ) ) \
+  && !defined( _DEFAULT_SOURCE )
+# define _DEFAULT_SOURCE
+#endif /* if ( defined( SIXPACK_MMAP ) || defined( SIXPACK_DIRS ) )
+           && !defined( _DEFAULT_SOURCE ) */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -47,6 +64,26 @@
 #endif /* ifdef TESTING */
 
 #include "fastlz.h"
+#include "sixpack_io.h"
+
+/* Pipelined compression with -T, built with -DSIXPACK_THREADS */
+#if defined( SIXPACK_THREADS )
+# include <pthread.h>
+# include <sys/time.h>
+# include "fastlz_pool.h"
+#endif /* if defined( SIXPACK_THREADS ) */
+
+/* Compression from a mapping of the input, built with -DSIXPACK_MMAP */
+#if defined( SIXPACK_MMAP )
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif /* if defined( SIXPACK_MMAP ) */
+
+#if defined( SIXPACK_DIRS )
+# include <dirent.h>
+# include <sys/stat.h>
+#endif /* if defined( SIXPACK_DIRS ) */
 
 #undef PATH_SEPARATOR
 
@@ -74,18 +111,34 @@
 #endif /* if defined ( WIN32 )  || defined( __NT__ )
            || defined( _WIN32 ) || defined( __WIN32__ ) */
 
+/* Millisecond timer for the in-memory benchmark */
+#if defined( SIXPACK_BENCHMARK_WIN32 )
+# define SIXPACK_TICKS()  GetTickCount()
+#else  /* if defined( SIXPACK_BENCHMARK_WIN32 ) */
+# include <time.h>
+# define SIXPACK_TICKS()  \
+  ((unsigned long)((double)clock() * 1000. / CLOCKS_PER_SEC ))
+#endif /* if defined( SIXPACK_BENCHMARK_WIN32 ) */
+
 /* Magic identifier for 6pack file */
 static unsigned char sixpack_magic[8] = {
   137, '6', 'P', 'K', 13, 10, 26, 10
 };
 
+/* File entries of streamed input have all the bits of their size set */
+#define SIXPACK_SIZE_UNKNOWN  255
+
+/* Block size, unless given with -B */
 #ifndef BLOCK_SIZE
-# define BLOCK_SIZE  65535
+# define BLOCK_SIZE  65536
 #endif /* ifndef BLOCK_SIZE */
 
-#if ( BLOCK_SIZE > 2621440 )
-# error BLOCK_SIZE too large ( > 2621440 )
-#endif /* if ( BLOCK_SIZE > 2621440 */
+/* Largest block; buffers are on the heap, the bound only limits memory */
+#define BLOCK_SIZE_MAX  67108864
+
+#if ( BLOCK_SIZE > BLOCK_SIZE_MAX )
+# error BLOCK_SIZE too large ( > 67108864 )
+#endif /* if ( BLOCK_SIZE > BLOCK_SIZE_MAX ) */
 
 #if ( BLOCK_SIZE < 256 )
 # error BLOCK_SIZE too small ( < 256 )
@@ -96,14 +149,18 @@ static unsigned long update_adler32(unsigned long checksum, const void *buf,
                                     int len);
 void usage(void);
 int detect_magic(FILE *f);
-void write_magic(FILE *f);
-void write_chunk_header(FILE *f, int id, int options, unsigned long size,
+void write_magic(sixpack_io *f);
+void write_chunk_header(sixpack_io *f, int id, int options, unsigned long size,
                         unsigned long checksum, unsigned long extra);
 unsigned long block_compress(const unsigned char *input, unsigned long length,
                              unsigned char *output);
-int pack_file_compressed(const char *input_file, int method, int level,
-                         FILE *f);
-int pack_file(int compress_level, const char *input_file,
+struct pack_index;
+int pack_file_compressed(const char *input_file, const char *name,
+                         int method, int level, int threads, int block_size,
+                         int io_flags, sixpack_io *f,
+                         struct pack_index *index);
+int pack_file(int compress_level, int threads, int block_size, int io_flags,
+              int seekable, char **input_files, int inputs,
               const char *output_file);
 
 /* Adler-32 checksum algorithm; see RFC-1950, Section 8.2 */
@@ -158,15 +215,28 @@ usage(void)
   printf("6pack: high-speed file compression tool\n");
   printf("Copyright (C) Ariya Hidayat\n");
   printf("\n");
-  printf("Usage: 6pack [options]  input-file  output-file\n");
+  printf("Usage: 6pack [options]  input-file...  output-file\n");
+  printf("\n");
+  printf("Use - for standard input or output.\n");
+#if defined( SIXPACK_DIRS )
+  printf("Directories are packed with all the files below them.\n");
+#endif /* if defined( SIXPACK_DIRS ) */
   printf("\n");
   printf("Options:\n");
   printf("  -1    compress faster\n");
   printf("  -2    compress better\n");
+#if defined( SIXPACK_THREADS )
+  printf("  -T N  compress with N threads\n");
+#endif /* if defined( SIXPACK_THREADS ) */
+  printf("  -B N  compress blocks of N bytes (K or M suffix), default %d\n",
+         BLOCK_SIZE);
+  printf("  --direct  bypass the page cache (O_DIRECT)\n");
+  printf("  --index   add a block index, for random access\n");
   printf("  -v    show program version\n");
-#ifdef SIXPACK_BENCHMARK_WIN32
-    printf("  -mem  check in-memory compression speed\n");
-#endif /* ifdef SIXPACK_BENCHMARK_WIN32 */
+  printf("  -mem  check in-memory compression speed\n");
+#if defined( SIXPACK_THREADS )
+  printf("        (with -T N, also of the thread pool)\n");
+#endif /* if defined( SIXPACK_THREADS ) */
   printf("\n");
 }
 
@@ -202,17 +272,17 @@ detect_magic(FILE *f)
 }
 
 void
-write_magic(FILE *f)
+write_magic(sixpack_io *f)
 {
-  fwrite(sixpack_magic, 8, 1, f);
+  sixpack_io_write(f, sixpack_magic, 8);
 }
 
-void
-write_chunk_header(FILE *f, int id, int options, unsigned long size,
-                   unsigned long checksum, unsigned long extra)
+/* Chunk header into the 16 bytes of buffer */
+static void
+put_chunk_header(unsigned char *buffer, int id, int options,
+                 unsigned long size, unsigned long checksum,
+                 unsigned long extra)
 {
-  unsigned char buffer[16];
-
   buffer[0]   = id & 255;
   buffer[1]   = id >> 8;
   buffer[2]   = options & 255;
@@ -229,89 +299,54 @@ write_chunk_header(FILE *f, int id, int options, unsigned long size,
   buffer[13]  = ( extra >> 8 ) & 255;
   buffer[14]  = ( extra >> 16 ) & 255;
   buffer[15]  = ( extra >> 24 ) & 255;
+}
+
+void
+write_chunk_header(sixpack_io *f, int id, int options, unsigned long size,
+                   unsigned long checksum, unsigned long extra)
+{
+  unsigned char buffer[16];
 
-  fwrite(buffer, 16, 1, f);
+  put_chunk_header(buffer, id, options, size, checksum, extra);
+  sixpack_io_write(f, buffer, 16);
 }
 
-int
-pack_file_compressed(const char *input_file, int method, int level, FILE *f)
+/* Extend the progress bar to total_read out of fsize, if known */
+static void
+show_progress(sixpack_off total_read, sixpack_off fsize,
+              unsigned long *percent)
 {
-  FILE *         in;
-  unsigned long  fsize;
-  unsigned long  checksum;
-  const char *   shown_name;
-  unsigned char  buffer[BLOCK_SIZE];
-  unsigned char  result[BLOCK_SIZE * 2]; /* FIXME: Twice is too large */
-  unsigned char  progress[20];
-  int            c;
-  unsigned long  percent;
-  unsigned long  total_read;
-  unsigned long  total_compressed;
-  int            chunk_size;
+  int last_percent = (int)*percent;
 
-  /* Sanity check */
-  in = fopen(input_file, "rb");
-  if (!in)
+  if (fsize == 0)
     {
-      printf("Error: could not open %s\n", input_file);
-      return -1;
+      return;
     }
 
-  /* Find size of the file */
-  fseek(in, 0, SEEK_END);
-  fsize = ftell(in);
-  fseek(in, 0, SEEK_SET);
-
-  /* Already a 6pack archive? */
-  if (detect_magic(in))
+  if (fsize < ( 1 << 24 ))
     {
-      printf("Error: file %s is already a 6pack archive!\n", input_file);
-      fclose(in);
-      return -1;
+      *percent = total_read * 100 / fsize;
+    }
+  else
+    {
+      *percent = total_read / 256 * 100 / ( fsize >> 8 );
     }
 
-  /* Truncate directory prefix, e.g. "foo/bar/FILE.txt" becomes "FILE.txt" */
-  shown_name = input_file + strlen(input_file) - 1;
-  while (shown_name > input_file)
+  *percent >>= 1;
+  while (last_percent < (int)*percent)
     {
-      if (*( shown_name - 1 ) == PATH_SEPARATOR)
-        {
-          break;
-        }
-      else
-        {
-          shown_name--;
-        }
+      printf("#");
+      last_percent++;
     }
+}
 
-  /* Chunk for File Entry */
-  buffer[0]    = fsize & 255;
-  buffer[1]    = ( fsize >> 8 ) & 255;
-  buffer[2]    = ( fsize >> 16 ) & 255;
-  buffer[3]    = ( fsize >> 24 ) & 255;
-#if 0
-    buffer[4]  = ( fsize >> 32 ) & 255;
-    buffer[5]  = ( fsize >> 40 ) & 255;
-    buffer[6]  = ( fsize >> 48 ) & 255;
-    buffer[7]  = ( fsize >> 56 ) & 255;
-#else  /* if 0 */
-    /* ... because fsize is only 32-bit */
-    buffer[4]  = 0;
-    buffer[5]  = 0;
-    buffer[6]  = 0;
-    buffer[7]  = 0;
-#endif /* if 0 */
-  buffer[8]    = ( strlen(shown_name) + 1 ) & 255;
-  buffer[9]    = ( strlen(shown_name) + 1 ) >> 8;
-  checksum     = 1L;
-  checksum     = update_adler32(checksum, buffer, 10);
-  checksum     = update_adler32(checksum, shown_name, strlen(shown_name) + 1);
-  write_chunk_header(f, 1, 0, 10 + strlen(shown_name) + 1, checksum, 0);
-  fwrite(buffer, 10, 1, f);
-  fwrite(shown_name, strlen(shown_name) + 1, 1, f);
-  total_compressed = 16 + 10 + strlen(shown_name) + 1;
+/* Start the progress bar of a file */
+static void
+show_name(const char *shown_name)
+{
+  unsigned char  progress[20];
+  int            c;
 
-  /* For progress status */
   memset(progress, ' ', 20);
   if (strlen(shown_name) < 16)
     {
@@ -342,339 +377,2144 @@ pack_file_compressed(const char *input_file, int method, int level, FILE *f)
 
   printf("]\r");
   printf("%s", progress);
+}
 
-  /* Read file and place in archive */
-  total_read  = 0;
-  percent     = 0;
-  for (;;)
-    {
-      int     compress_method  = method;
-      int     last_percent     = (int)percent;
-      size_t  bytes_read       = fread(buffer, 1, BLOCK_SIZE, in);
-      if (bytes_read == 0)
-        {
-          break;
-        }
-
-      total_read += bytes_read;
+/* Close the progress bar with the space saved on a file */
+static void
+show_saved(sixpack_off total_compressed, sixpack_off fsize)
+{
+  unsigned long percent;
 
-      /* For progress */
-      if (fsize < ( 1 << 24 ))
+  printf("] ");
+  if (total_compressed < fsize)
+    {
+      if (fsize < ( 1 << 20 ))
         {
-          percent = total_read * 100 / fsize;
+          percent = total_compressed * 1000 / fsize;
         }
       else
         {
-          percent = total_read / 256 * 100 / ( fsize >> 8 );
+          percent = total_compressed / ( fsize / 1000 );
         }
 
-      percent >>= 1;
-      while (last_percent < (int)percent)
-        {
-          printf("#");
-          last_percent++;
-        }
+      percent = 1000 - percent;
+      printf("%2d.%d%% saved", (int)percent / 10, (int)percent % 10);
+    }
 
-      /* Too small, don't bother to compress */
-      if (bytes_read < 32)
-        {
-          compress_method = 0;
-        }
+  printf("\n");
+}
 
-      /* Write to output */
-      switch (compress_method)
-        {
-        /* FastLZ */
-        case 1:
-          chunk_size
-                    = fastlz_compress_level(level, buffer, bytes_read, result);
-          checksum  = update_adler32(1L, result, chunk_size);
-          write_chunk_header(f, 17, 1, chunk_size, checksum, bytes_read);
-          fwrite(result, 1, chunk_size, f);
-          total_compressed  += 16;
-          total_compressed  += chunk_size;
-          break;
+/*
+ * Block index of a seekable archive, written with --index. Each data chunk
+ * gets an entry of SIXPACK_INDEX_ENTRY bytes: the offset of its header in
+ * the archive and of its block in the file (64-bit), then its compressed
+ * and uncompressed sizes (32-bit), all little endian. The entries follow
+ * the file entry they belong to, so the offsets in the file start again at
+ * zero for a new file. The index is stored as one chunk at the end of the
+ * archive, before the central directory. Entries are collected for every
+ * archive, as they also track the position of each file entry, but only
+ * written with --index. Readers that do not know these chunks skip them.
+ */
 
-        /* Uncompressed, also fallback method */
-        case 0:
-        default:
-          checksum  = 1L;
-          checksum  = update_adler32(checksum, buffer, bytes_read);
-          write_chunk_header(f, 17, 0, bytes_read, checksum, bytes_read);
-          fwrite(buffer, 1, bytes_read, f);
-          total_compressed  += 16;
-          total_compressed  += bytes_read;
-          break;
-        }
+#define SIXPACK_CHUNK_INDEX   32
+#define SIXPACK_INDEX_ENTRY   24
+
+typedef struct pack_index
+{
+  unsigned char * entries;
+  unsigned long   count;
+  unsigned long   capacity;
+  sixpack_off     position;  /* in the archive, of the next chunk */
+  sixpack_off     offset;    /* in the file, of the next block */
+  int             failed;
+} pack_index;
+
+/* Little endian, in length bytes */
+static void
+write_le(unsigned char *ptr, sixpack_off value, int length)
+{
+  int c;
+
+  for (c = 0; c < length; c++, value >>= 8)
+    {
+      ptr[c] = value & 255;
     }
+}
 
-  fclose(in);
-  if (total_read != fsize)
+/* Account for a chunk that is not indexed, e.g. a file entry */
+static void
+pack_index_skip(pack_index *index, unsigned long chunk_size)
+{
+  if (index)
     {
-      printf("\n");
-      printf("Error: reading %s failed!\n", input_file);
-      return -1;
+      index->position  += 16 + chunk_size;
+      index->offset     = 0;
     }
-  else
+}
+
+/* Add the data chunk about to be written */
+static void
+pack_index_add(pack_index *index, unsigned long chunk_size,
+               unsigned long block_size)
+{
+  unsigned char * entry;
+
+  if (!index)
     {
-      printf("] ");
-      if (total_compressed < fsize)
-        {
-          if (fsize < ( 1 << 20 ))
-            {
-              percent = total_compressed * 1000 / fsize;
-            }
-          else
-            {
-              percent = total_compressed / 256 * 1000 / ( fsize >> 8 );
-            }
+      return;
+    }
+
+  if (index->count == index->capacity && !index->failed)
+    {
+      unsigned long    capacity  = index->capacity ? 2 * index->capacity
+                                                    : 1024;
+      unsigned char *  entries   = (unsigned char *)realloc(
+        index->entries, capacity * SIXPACK_INDEX_ENTRY);
 
-          percent = 1000 - percent;
-          printf("%2d.%d%% saved", (int)percent / 10, (int)percent % 10);
+      if (entries)
+        {
+          index->entries   = entries;
+          index->capacity  = capacity;
+        }
+      else
+        {
+          index->failed = 1;
         }
+    }
 
-      printf("\n");
+  if (!index->failed)
+    {
+      entry = index->entries + index->count * SIXPACK_INDEX_ENTRY;
+      write_le(entry, index->position, 8);
+      write_le(entry + 8, index->offset, 8);
+      write_le(entry + 16, chunk_size, 4);
+      write_le(entry + 20, block_size, 4);
+      index->count++;
     }
 
-  return 0;
+  index->position  += 16 + chunk_size;
+  index->offset    += block_size;
 }
 
-int
-pack_file(int compress_level, const char *input_file, const char *output_file)
+/*
+ * Central directory: for each file, the position of its file entry chunk
+ * in the archive (64-bit), its size (64-bit), and its name as in the file
+ * entry (16-bit length, then the name and a terminating zero). It is one
+ * chunk, with the number of files as its extra field, so that readers can
+ * list an archive and find a file without reading through the others.
+ *
+ * Every archive ends with a footer chunk of a fixed size, so that readers
+ * find both from the end: its 16 bytes give the position and number of
+ * entries of the block index (zero without --index), and its extra field
+ * the size of the directory chunk right before it, header included.
+ */
+
+#define SIXPACK_CHUNK_FOOTER     33
+#define SIXPACK_CHUNK_DIRECTORY  34
+#define SIXPACK_FOOTER_SIZE      32
+#define SIXPACK_MEMBER_SIZE      18
+
+typedef struct pack_directory
 {
-  FILE * f;
-  int    result;
+  unsigned char * entries;
+  unsigned long   length;
+  unsigned long   capacity;
+  unsigned long   count;
+  int             failed;
+} pack_directory;
+
+/* Add the file whose entry chunk was written at position */
+static void
+pack_directory_add(pack_directory *directory, sixpack_off position,
+                   sixpack_off size, const char *name)
+{
+  unsigned long   length  = strlen(name) + 1;
+  unsigned char * entry;
 
-  if (!output_file)
+  if (directory->length + SIXPACK_MEMBER_SIZE + length > directory->capacity
+      && !directory->failed)
     {
-      printf("Error: invalid output file. Aborted.\n\n");
-      return -1;
+      unsigned long    capacity  = 2 * directory->capacity
+                                   + SIXPACK_MEMBER_SIZE + length + 4096;
+      unsigned char *  entries   = (unsigned char *)realloc(
+        directory->entries, capacity);
+
+      if (entries)
+        {
+          directory->entries   = entries;
+          directory->capacity  = capacity;
+        }
+      else
+        {
+          directory->failed = 1;
+        }
     }
 
-  f = fopen(output_file, "rb");
-  if (f)
+  if (!directory->failed)
     {
-      fclose(f);
-      printf("Error: file %s already exists. Aborted.\n\n", output_file);
-      return -1;
+      entry = directory->entries + directory->length;
+      write_le(entry, position, 8);
+      write_le(entry + 8, size, 8);
+      write_le(entry + 16, length, 2);
+      memcpy(entry + SIXPACK_MEMBER_SIZE, name, length);
+      directory->length  += SIXPACK_MEMBER_SIZE + length;
+      directory->count++;
     }
+}
 
-  f = fopen(output_file, "wb");
-  if (!f)
+/*
+ * Append the index chunk if seekable, the directory and the footer.
+ * Returns 0, or -1 if impossible.
+ */
+
+static int
+pack_tail_write(pack_index *index, pack_directory *directory, int seekable,
+                sixpack_io *f)
+{
+  unsigned long  size  = seekable ? index->count * SIXPACK_INDEX_ENTRY : 0;
+  unsigned char  footer[16];
+
+  /* Out of memory, or too large for a chunk and the checksum */
+  if (directory->failed || directory->length > 0x7fffffffUL
+      || ( seekable && ( index->failed
+                         || index->count
+                            > 0x7fffffffUL / SIXPACK_INDEX_ENTRY )))
     {
-      printf("Error: could not create %s. Aborted.\n\n", output_file);
       return -1;
     }
 
-  write_magic(f);
+  write_le(footer, seekable ? index->position : 0, 8);
+  write_le(footer + 8, seekable ? index->count : 0, 8);
+  if (seekable)
+    {
+      write_chunk_header(f, SIXPACK_CHUNK_INDEX, 0, size,
+                         update_adler32(1L, index->entries, (int)size),
+                         index->count);
+      sixpack_io_write(f, index->entries, size);
+    }
 
-  result = pack_file_compressed(input_file, 1, compress_level, f);
-  fclose(f);
+  write_chunk_header(f, SIXPACK_CHUNK_DIRECTORY, 0, directory->length,
+                     update_adler32(1L, directory->entries,
+                                    (int)directory->length),
+                     directory->count);
+  if (directory->length > 0)
+    {
+      sixpack_io_write(f, directory->entries, directory->length);
+    }
 
-  return result;
+  write_chunk_header(f, SIXPACK_CHUNK_FOOTER, 0, 16,
+                     update_adler32(1L, footer, 16), 16 + directory->length);
+  sixpack_io_write(f, footer, 16);
+  return 0;
 }
 
-#ifdef SIXPACK_BENCHMARK_WIN32
-  int benchmark_speed(int compress_level, const char *input_file);
+/*
+ * Input blocks of the file being packed. Regular files are mapped when
+ * possible, so that blocks are compressed in place; otherwise they are
+ * read ahead by a sixpack_io reader, or with fread if it can not start.
+ * With SIXPACK_IO_DIRECT, the page cache is avoided: no mapping then.
+ */
 
-  int
-  benchmark_speed(int compress_level, const char *input_file)
+typedef struct pack_source
+{
+  FILE *                in;
+  sixpack_io *          io;
+  const unsigned char * map;
+  sixpack_off           size;
+  sixpack_off           offset;
+  size_t                block;
+} pack_source;
+
+static void
+pack_source_open(pack_source *src, FILE *in, sixpack_off fsize,
+                 size_t block, int io_flags)
+{
+  src->in      = in;
+  src->io      = NULL;
+  src->map     = NULL;
+  src->size    = fsize;
+  src->offset  = 0;
+  src->block   = block;
+
+#if defined( SIXPACK_MMAP )
   {
-    FILE *          in;
-    unsigned long   fsize;
-    unsigned long   maxout;
-    const char *    shown_name;
-    unsigned char * buffer;
-    unsigned char * result;
-    size_t          bytes_read;
-
-    /* sanity check */
-    in = fopen(input_file, "rb");
-    if (!in)
-      {
-        printf("Error: could not open %s\n", input_file);
-        return -1;
-      }
+    struct stat  st;
+    void *       map = MAP_FAILED;
 
-    /* find size of the file */
-    fseek(in, 0, SEEK_END);
-    fsize = ftell(in);
-    fseek(in, 0, SEEK_SET);
-
-    /* already a 6pack archive? */
-    if (detect_magic(in))
+    if (fsize > 0 && !( io_flags & SIXPACK_IO_DIRECT )
+        && (sixpack_off)(size_t)fsize == fsize
+        && fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode)
+        && (sixpack_off)st.st_size == fsize)
       {
-        printf("Error: no benchmark for 6pack archive!\n");
-        fclose(in);
-        return -1;
+        map = mmap(NULL, (size_t)fsize, PROT_READ, MAP_PRIVATE, fileno(in), 0);
       }
 
-    /* Truncate directory prefix, e.g. "foo/bar/FILE.txt" becomes "FILE.txt" */
-    shown_name = input_file + strlen(input_file) - 1;
-    while (shown_name > input_file)
+    if (map == MAP_FAILED)
       {
-        if (*( shown_name - 1 ) == PATH_SEPARATOR)
-          {
-            break;
-          }
-        else
-          {
-            shown_name--;
-          }
+        src->io = sixpack_io_reader(in, block, SIXPACK_IO_DEPTH, io_flags);
+        return;
       }
 
-    maxout  = 1.05 * fsize;
-    maxout  = ( maxout < 66 ) ? 66 : maxout;
-    buffer  = (unsigned char *)malloc(fsize);
-    result  = (unsigned char *)malloc(maxout);
-    if (!buffer || !result)
-      {
-        printf("Error: not enough memory!\n");
-        FREE(buffer);
-        FREE(result);
-        fclose(in);
-        return -1;
-      }
+    /* Hints only, failures do not matter */
+    (void)madvise(map, (size_t)fsize, MADV_SEQUENTIAL);
+# if defined( MADV_HUGEPAGE )
+    (void)madvise(map, (size_t)fsize, MADV_HUGEPAGE);
+# endif /* if defined( MADV_HUGEPAGE ) */
 
-    printf("Reading source file....\n");
-    bytes_read = fread(buffer, 1, fsize, in);
-    if (bytes_read != fsize)
-      {
-        printf("Error reading file %s!\n", shown_name);
-        printf("Read %d bytes, expecting %d bytes\n", bytes_read, fsize);
-        FREE(buffer);
-        FREE(result);
-        fclose(in);
-        return -1;
-      }
+    src->map = (const unsigned char *)map;
+  }
+#else  /* if defined( SIXPACK_MMAP ) */
+  src->io = sixpack_io_reader(in, block, SIXPACK_IO_DEPTH, io_flags);
+#endif /* if defined( SIXPACK_MMAP ) */
+}
 
-    /* shamelessly copied from QuickLZ 1.20 test program */
-    {
-      unsigned int   j, y;
-      size_t         i, u = 0;
-      double         mbs, fastest;
-      unsigned long  compressed_size;
+/*
+ * Next block of at most src->block bytes, in *block; 0 at the end. The
+ * block is valid until the next call, unless keep is set: then it stays
+ * valid as long as buffer, into which it is copied if necessary.
+ */
 
-      printf("Setting HIGH_PRIORITY_CLASS...\n");
-      SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
+static size_t
+pack_source_read(pack_source *src, unsigned char *buffer, int keep,
+                 const unsigned char **block)
+{
+  size_t bytes_read;
 
-      printf("Benchmarking FastLZ Level %d, please wait...\n", compress_level);
+  if (src->map)
+    {
+      bytes_read = src->size - src->offset < src->block
+                     ? (size_t)( src->size - src->offset )
+                     : src->block;
+      *block        = src->map + src->offset;
+      src->offset  += bytes_read;
+      return bytes_read;
+    }
 
-      i        = bytes_read;
-      fastest  = 0.0;
-      for (j = 0; j < 3; j++)
+  if (src->io)
+    {
+      bytes_read = sixpack_io_read(src->io, block);
+      if (keep)
         {
-          y    = 0;
-          mbs  = GetTickCount();
-          while (GetTickCount() == mbs)
-            {
-              ;
-            }
-          mbs = GetTickCount();
-          while (GetTickCount() - mbs < 3000) /* 1% accuracy with 18.2 timer */
-            {
-              u = fastlz_compress_level(
-                compress_level,
-                buffer,
-                bytes_read,
-                result);
-              y++;
-            }
-
-          mbs = ((double)i * (double)y )
-                / ((double)( GetTickCount() - mbs ) / 1000. ) / 1000000.;
-          /*printf(" %.1f Mbyte/s  ", mbs);*/
-          if (fastest < mbs)
-            {
-              fastest = mbs;
-            }
+          memcpy(buffer, *block, bytes_read);
+          *block = buffer;
         }
 
-      printf(
-        "\nCompressed %d bytes into %d bytes (%.1f%%) at %.1f Mbyte/s.\n",
-        (unsigned int)i,
-        (unsigned int)u,
-        (double)u / (double)i * 100.,
-        fastest);
-
-# if 1
-        fastest          = 0.0;
-        compressed_size  = u;
-        for (j = 0; j < 3; j++)
-          {
-            y    = 0;
-            mbs  = GetTickCount();
-            while (GetTickCount() == mbs)
-              {
-                ;
-              }
-            mbs = GetTickCount();
-            while (GetTickCount() - mbs < 3000) /* 1% accuracy with 18.2 timer */
-              {
-                u = fastlz_decompress(
-                  result,
-                  compressed_size,
-                  buffer,
-                  bytes_read);
-                y++;
-              }
-
-            mbs = ((double)i * (double)y )
-                  / ((double)( GetTickCount() - mbs ) / 1000. ) / 1000000.;
-            /*printf(" %.1f Mbyte/s  ", mbs);*/
-            if (fastest < mbs)
-              {
-                fastest = mbs;
-              }
-          }
-
-        printf(
-          "\nDecompressed at %.1f Mbyte/s.\n\n(1 MB = 1000000 byte)\n",
-          fastest);
-# endif /* if 1 */
+      return bytes_read;
     }
 
-    fclose(in);
-    return 0;
-  }
-#endif /* SIXPACK_BENCHMARK_WIN32 */
+  *block = buffer;
+  return fread(buffer, 1, src->block, src->in);
+}
 
-int
-main(int argc, char **argv)
+static void
+pack_source_close(pack_source *src)
 {
-  int    i;
-  int    compress_level;
-  int    benchmark;
-  char * input_file;
-  char * output_file;
+#if defined( SIXPACK_MMAP )
+  if (src->map)
+    {
+      munmap((void *)src->map, (size_t)src->size);
+    }
+#endif /* if defined( SIXPACK_MMAP ) */
 
-  /* Show help with no argument at all*/
-  if (argc == 1)
+  if (src->io)
     {
-      usage();
-      return 0;
+      sixpack_io_close(src->io);
     }
 
-  /* Default compression level, not the fastest */
-  compress_level = 2;
+  src->io   = NULL;
+  src->map  = NULL;
+}
 
-  /* Do benchmark only when explicitly specified */
-  benchmark = 0;
+#if defined( SIXPACK_THREADS )
+
+/*
+ * Pipelined compression: this thread reads blocks into a ring of slots and
+ * hands them to the workers of a fastlz_pool, which also compute the
+ * checksum. A writer thread takes the slots back in order, so the archive
+ * is the same as the one written by a single thread. The ring bounds the
+ * number of blocks in flight; the reader waits for the writer to free a
+ * slot when it is full.
+ */
 
-  /* No file is specified */
-  input_file   = 0;
-  output_file  = 0;
+typedef struct pack_slot
+{
+  fastlz_job     job;
+  int            method;
+  size_t         bytes_read;
+  unsigned long         checksum;
+  const unsigned char  *input;
+  unsigned char        *buffer;
+  unsigned char        *result;
+} pack_slot;
 
-  for (i = 1; i <= argc; i++)
+typedef struct pack_pipeline
+{
+  fastlz_pool *    pool;
+  pack_slot *      slots;
+  unsigned long    count;
+  unsigned long    submitted;
+  unsigned long    written;
+  int              eof;
+  sixpack_io *     f;
+  pack_index *     index;
+  sixpack_off      total_compressed;
+  pthread_mutex_t  lock;
+  pthread_cond_t   cond;
+} pack_pipeline;
+
+static void
+pack_block_done(fastlz_job *job)
+{
+  pack_slot *slot = (pack_slot *)job->user;
+
+  slot->checksum = update_adler32(1L, slot->result, job->result);
+}
+
+static void *
+pack_writer(void *arg)
+{
+  pack_pipeline * pipe  = (pack_pipeline *)arg;
+
+  for (;;)
     {
-      char *argument = argv[i];
+      pack_slot * slot;
+      int         chunk_size;
 
-      if (!argument)
+      pthread_mutex_lock(&pipe->lock);
+      while (pipe->written == pipe->submitted && !pipe->eof)
         {
-          continue;
+          pthread_cond_wait(&pipe->cond, &pipe->lock);
         }
 
-      /* Display help on usage */
+      if (pipe->written == pipe->submitted)
+        {
+          pthread_mutex_unlock(&pipe->lock);
+          break;
+        }
+
+      slot = &pipe->slots[pipe->written % pipe->count];
+      pthread_mutex_unlock(&pipe->lock);
+
+      if (slot->method == 1)
+        {
+          chunk_size = fastlz_pool_wait(pipe->pool, &slot->job);
+          pack_index_add(pipe->index, chunk_size, slot->bytes_read);
+          write_chunk_header(pipe->f, 17, 1, chunk_size, slot->checksum,
+                             slot->bytes_read);
+          sixpack_io_write(pipe->f, slot->result, chunk_size);
+        }
+      else
+        {
+          chunk_size = (int)slot->bytes_read;
+          pack_index_add(pipe->index, chunk_size, slot->bytes_read);
+          write_chunk_header(pipe->f, 17, 0, chunk_size, slot->checksum,
+                             slot->bytes_read);
+          sixpack_io_write(pipe->f, slot->input, chunk_size);
+        }
+
+      pipe->total_compressed += 16 + chunk_size;
+
+      pthread_mutex_lock(&pipe->lock);
+      pipe->written++;
+      pthread_cond_broadcast(&pipe->cond);
+      pthread_mutex_unlock(&pipe->lock);
+    }
+
+  return NULL;
+}
+
+/*
+ * Compress the rest of in to f with the given number of threads.
+ * Returns 0, or -1 if the threads or buffers can not be created.
+ */
+
+static int
+pack_blocks_threaded(pack_source *src, sixpack_io *f, pack_index *index,
+                     int method, int level, int threads,
+                     sixpack_off fsize, sixpack_off *total_read,
+                     sixpack_off *total_compressed)
+{
+  pack_pipeline  pipe;
+  pthread_t      writer;
+  unsigned long  percent = 0;
+  unsigned long  c;
+  int            status  = 0;
+
+  pipe.count             = 2 * threads + 2;
+  pipe.submitted         = 0;
+  pipe.written           = 0;
+  pipe.eof               = 0;
+  pipe.f                 = f;
+  pipe.index             = index;
+  pipe.total_compressed  = 0;
+  pipe.pool              = fastlz_pool_create(threads);
+  pipe.slots             = (pack_slot *)calloc(pipe.count, sizeof(pack_slot));
+  for (c = 0; pipe.slots && c < pipe.count; c++)
+    {
+      pipe.slots[c].buffer
+        = src->map ? NULL : (unsigned char *)sixpack_io_alloc(src->block);
+      pipe.slots[c].result = (unsigned char *)sixpack_io_alloc(
+        FASTLZ_COMPRESS_BOUND(src->block));
+      if (( !src->map && !pipe.slots[c].buffer ) || !pipe.slots[c].result)
+        {
+          status = -1;
+        }
+    }
+
+  if (!pipe.pool || !pipe.slots || status < 0)
+    {
+      printf("\nError: could not start %d threads!\n", threads);
+      status = -1;
+      goto cleanup;
+    }
+
+  pthread_mutex_init(&pipe.lock, NULL);
+  pthread_cond_init(&pipe.cond, NULL);
+  if (pthread_create(&writer, NULL, pack_writer, &pipe) != 0)
+    {
+      printf("\nError: could not start %d threads!\n", threads);
+      status = -1;
+      goto cleanup_sync;
+    }
+
+  for (;;)
+    {
+      pack_slot * slot;
+
+      pthread_mutex_lock(&pipe.lock);
+      while (pipe.submitted - pipe.written >= pipe.count)
+        {
+          pthread_cond_wait(&pipe.cond, &pipe.lock);
+        }
+
+      pthread_mutex_unlock(&pipe.lock);
+
+      slot              = &pipe.slots[pipe.submitted % pipe.count];
+      slot->bytes_read  = pack_source_read(src, slot->buffer, 1,
+                                           &slot->input);
+      if (slot->bytes_read == 0)
+        {
+          break;
+        }
+
+      *total_read += slot->bytes_read;
+      show_progress(*total_read, fsize, &percent);
+
+      /* Too small, don't bother to compress */
+      slot->method = slot->bytes_read < 32 ? 0 : method;
+      if (slot->method == 1)
+        {
+          slot->job.op        = FASTLZ_JOB_COMPRESS;
+          slot->job.level     = level;
+          slot->job.input     = slot->input;
+          slot->job.length    = (int)slot->bytes_read;
+          slot->job.output    = slot->result;
+          slot->job.maxout    = FASTLZ_COMPRESS_BOUND(src->block);
+          slot->job.callback  = pack_block_done;
+          slot->job.user      = slot;
+          fastlz_pool_submit(pipe.pool, &slot->job);
+        }
+      else
+        {
+          slot->method    = 0;
+          slot->checksum  = update_adler32(1L, slot->input,
+                                           slot->bytes_read);
+        }
+
+      pthread_mutex_lock(&pipe.lock);
+      pipe.submitted++;
+      pthread_cond_broadcast(&pipe.cond);
+      pthread_mutex_unlock(&pipe.lock);
+    }
+
+  pthread_mutex_lock(&pipe.lock);
+  pipe.eof = 1;
+  pthread_cond_broadcast(&pipe.cond);
+  pthread_mutex_unlock(&pipe.lock);
+  pthread_join(writer, NULL);
+  *total_compressed += pipe.total_compressed;
+
+cleanup_sync:
+  pthread_cond_destroy(&pipe.cond);
+  pthread_mutex_destroy(&pipe.lock);
+
+cleanup:
+  if (pipe.pool)
+    {
+      fastlz_pool_destroy(pipe.pool);
+    }
+
+  for (c = 0; pipe.slots && c < pipe.count; c++)
+    {
+      FREE(pipe.slots[c].buffer);
+      FREE(pipe.slots[c].result);
+    }
+
+  FREE(pipe.slots);
+  return status;
+}
+
+#endif /* if defined( SIXPACK_THREADS ) */
+
+/* Name without its directory, e.g. "foo/bar/FILE.txt" becomes "FILE.txt" */
+static const char *
+base_name(const char *path)
+{
+  const char *name = path + strlen(path) - 1;
+
+  while (name > path)
+    {
+      if (*( name - 1 ) == PATH_SEPARATOR)
+        {
+          break;
+        }
+      else
+        {
+          name--;
+        }
+    }
+
+  return name;
+}
+
+/*
+ * Chunk for File Entry, with the 64-bit size of the file.
+ * Returns the number of bytes written.
+ */
+
+static unsigned long
+write_file_entry(sixpack_io *f, pack_index *index, sixpack_off fsize,
+                 int streamed, const char *shown_name)
+{
+  unsigned char  buffer[10];
+  unsigned long  checksum;
+
+  write_le(buffer, fsize, 8);
+  if (streamed)
+    {
+      memset(buffer, SIXPACK_SIZE_UNKNOWN, 8);
+    }
+
+  buffer[8]    = ( strlen(shown_name) + 1 ) & 255;
+  buffer[9]    = ( strlen(shown_name) + 1 ) >> 8;
+  checksum     = 1L;
+  checksum     = update_adler32(checksum, buffer, 10);
+  checksum     = update_adler32(checksum, shown_name, strlen(shown_name) + 1);
+  write_chunk_header(f, 1, 0, 10 + strlen(shown_name) + 1, checksum, 0);
+  sixpack_io_write(f, buffer, 10);
+  sixpack_io_write(f, shown_name, strlen(shown_name) + 1);
+  pack_index_skip(index, 10 + strlen(shown_name) + 1);
+  return 16 + 10 + strlen(shown_name) + 1;
+}
+
+/*
+ * Pack input_file into the archive f as a file called name, or as its
+ * base name if name is NULL.
+ */
+
+int
+pack_file_compressed(const char *input_file, const char *name, int method,
+                     int level, int threads, int block_size, int io_flags,
+                     sixpack_io *f, pack_index *index)
+{
+  FILE *         in;
+  sixpack_off    fsize;
+  unsigned long  checksum;
+  const char *   shown_name;
+  unsigned char *buffer;
+  unsigned char *result;
+  unsigned long  percent;
+  sixpack_off    total_read;
+  sixpack_off    total_compressed;
+  int            chunk_size;
+  int            streamed;
+  pack_source    src;
+
+  /* Standard input is read once, without knowing its size */
+  streamed = !strcmp(input_file, "-");
+  if (streamed)
+    {
+      input_file = "stdin";
+    }
+
+  /* Sanity check */
+  in = streamed ? sixpack_io_stdin() : fopen(input_file, "rb");
+  if (!in)
+    {
+      printf("Error: could not open %s\n", input_file);
+      return -1;
+    }
+
+  /* Find size of the file; pipes and the like are streamed as stdin is */
+  fsize = 0;
+  if (!streamed && sixpack_io_size(in, &fsize) < 0)
+    {
+      fsize     = 0;
+      streamed  = 1;
+    }
+
+  /* Already a 6pack archive? */
+  if (!streamed && detect_magic(in))
+    {
+      printf("Error: file %s is already a 6pack archive!\n", input_file);
+      fclose(in);
+      return -1;
+    }
+
+  /* Blocks are compressed into result, unless the workers do it */
+  buffer  = (unsigned char *)sixpack_io_alloc(block_size);
+  result  = threads > 0 ? NULL : (unsigned char *)sixpack_io_alloc(
+    FASTLZ_COMPRESS_BOUND(block_size));
+  if (!buffer || ( !result && threads == 0 ))
+    {
+      printf("Error: not enough memory!\n");
+      FREE(buffer);
+      FREE(result);
+      if (in != stdin)
+        {
+          fclose(in);
+        }
+
+      return -1;
+    }
+
+  /* Truncate directory prefix */
+  shown_name = name ? name : base_name(input_file);
+
+  /* O_DIRECT needs a regular file, aligned blocks and io_uring */
+  pack_source_open(&src, in, fsize, block_size, io_flags);
+  if (( io_flags & SIXPACK_IO_DIRECT ) && src.io
+      && !sixpack_io_direct(src.io))
+    {
+      printf("Note: --direct is not possible for %s, it goes through the "
+             "page cache\n", input_file);
+    }
+
+  total_compressed = write_file_entry(f, index, fsize, streamed, shown_name);
+
+  /* For progress status */
+  show_name(shown_name);
+
+  /* Read file and place in archive */
+  total_read  = 0;
+  percent     = 0;
+#if defined( SIXPACK_THREADS )
+  if (threads > 0)
+    {
+      if (pack_blocks_threaded(&src, f, index, method, level, threads, fsize,
+                               &total_read, &total_compressed) < 0)
+        {
+          pack_source_close(&src);
+          FREE(buffer);
+          if (in != stdin)
+            {
+              fclose(in);
+            }
+
+          return -1;
+        }
+    }
+  else
+#else  /* if defined( SIXPACK_THREADS ) */
+  (void)threads;
+#endif /* if defined( SIXPACK_THREADS ) */
+  for (;;)
+    {
+      int                    compress_method  = method;
+      const unsigned char *  block;
+      size_t                 bytes_read
+        = pack_source_read(&src, buffer, 0, &block);
+      if (bytes_read == 0)
+        {
+          break;
+        }
+
+      total_read += bytes_read;
+
+      /* For progress */
+      show_progress(total_read, fsize, &percent);
+
+      /* Too small, don't bother to compress */
+      if (bytes_read < 32)
+        {
+          compress_method = 0;
+        }
+
+      /* Write to output */
+      switch (compress_method)
+        {
+        /* FastLZ */
+        case 1:
+          chunk_size
+                    = fastlz_compress_level(level, block, bytes_read, result);
+          checksum  = update_adler32(1L, result, chunk_size);
+          pack_index_add(index, chunk_size, bytes_read);
+          write_chunk_header(f, 17, 1, chunk_size, checksum, bytes_read);
+          sixpack_io_write(f, result, chunk_size);
+          total_compressed  += 16;
+          total_compressed  += chunk_size;
+          break;
+
+        /* Uncompressed, also fallback method */
+        case 0:
+        default:
+          checksum  = 1L;
+          checksum  = update_adler32(checksum, block, bytes_read);
+          pack_index_add(index, bytes_read, bytes_read);
+          write_chunk_header(f, 17, 0, bytes_read, checksum, bytes_read);
+          sixpack_io_write(f, block, bytes_read);
+          total_compressed  += 16;
+          total_compressed  += bytes_read;
+          break;
+        }
+    }
+
+  pack_source_close(&src);
+  FREE(buffer);
+  FREE(result);
+  if (streamed && !ferror(in))
+    {
+      fsize = total_read;
+    }
+
+  if (in != stdin)
+    {
+      fclose(in);
+    }
+
+  if (total_read != fsize)
+    {
+      printf("\n");
+      printf("Error: reading %s failed!\n", input_file);
+      return -1;
+    }
+  else
+    {
+      show_saved(total_compressed, fsize);
+    }
+
+  return 0;
+}
+
+#if defined( SIXPACK_THREADS )
+typedef struct pack_batch pack_batch;
+#endif /* if defined( SIXPACK_THREADS ) */
+
+/* An archive being written, and how files are packed into it */
+typedef struct pack_archive
+{
+  int             level;
+  int             threads;
+  int             block_size;
+  int             io_flags;
+  sixpack_io *    out;
+  pack_index      index;
+  pack_directory  directory;
+#if defined( SIXPACK_DIRS )
+  int             known;     /* device and inode of the archive are */
+  dev_t           device;
+  ino_t           inode;
+#endif /* if defined( SIXPACK_DIRS ) */
+#if defined( SIXPACK_THREADS )
+  pack_batch *    batch;     /* of files compressed ahead, with -T */
+#endif /* if defined( SIXPACK_THREADS ) */
+} pack_archive;
+
+/* Pack one file as name now, and list it in the directory */
+static int
+pack_member_now(pack_archive *archive, const char *input_file,
+                const char *name)
+{
+  sixpack_off position = archive->index.position;
+
+  if (pack_file_compressed(input_file, name, 1, archive->level,
+                           archive->threads, archive->block_size,
+                           archive->io_flags, archive->out,
+                           &archive->index) < 0)
+    {
+      return -1;
+    }
+
+  /* The index keeps count of the bytes of the file */
+  pack_directory_add(&archive->directory, position, archive->index.offset,
+                     name);
+  return 0;
+}
+
+#if defined( SIXPACK_THREADS )
+
+/*
+ * Files packed ahead with -T: the files to pack go into a ring of items,
+ * in the order of the archive. Worker threads take them in turn, read a
+ * small file whole and compress it into its chunks in memory, the same as
+ * the ones pack_file_compressed would write. The main thread writes the
+ * items back in order, so the archive does not depend on the number of
+ * threads. Files larger than SIXPACK_BATCH_FILE_MAX, standard input, and
+ * files that can not be read this way are left to the main thread, which
+ * packs them with the block pipeline (and reports their errors) when
+ * their turn comes, while the workers go on with the next ones.
+ */
+
+/* Largest file compressed whole by a worker */
+#define SIXPACK_BATCH_FILE_MAX  1048576
+
+/* Items in flight, per thread */
+#define SIXPACK_BATCH_DEPTH     4
+
+enum
+{
+  PACK_ITEM_WAITING,
+  PACK_ITEM_READY,
+  PACK_ITEM_SERIAL
+};
+
+typedef struct pack_item
+{
+  char *           path;
+  char *           name;
+  int              state;
+  sixpack_off      size;
+  unsigned char *  chunks;   /* headers and data, ready to be written */
+  unsigned long    length;
+} pack_item;
+
+struct pack_batch
+{
+  pack_item *      items;
+  unsigned long    count;
+  unsigned long    added;
+  unsigned long    taken;
+  unsigned long    written;
+  int              stop;
+  int              level;
+  int              block_size;
+  int              threads;
+  pthread_t *      workers;
+  pthread_mutex_t  lock;
+  pthread_cond_t   cond;
+};
+
+/*
+ * Read the file of item and compress it into item->chunks, or leave it
+ * to the main thread.
+ */
+
+static int
+pack_item_compress(pack_batch *batch, pack_item *item)
+{
+  FILE *           in;
+  unsigned char *  data;
+  unsigned char *  out;
+  sixpack_off      fsize;
+  unsigned long    done;
+  unsigned long    blocks;
+
+  in = fopen(item->path, "rb");
+  if (!in)
+    {
+      return PACK_ITEM_SERIAL;
+    }
+
+  if (sixpack_io_size(in, &fsize) < 0 || fsize > SIXPACK_BATCH_FILE_MAX
+      || detect_magic(in))
+    {
+      fclose(in);
+      return PACK_ITEM_SERIAL;
+    }
+
+  blocks  = (unsigned long)( fsize + batch->block_size - 1 )
+            / batch->block_size;
+  data    = (unsigned char *)malloc((size_t)fsize + 1);
+  out     = (unsigned char *)malloc(
+    blocks * ( 16 + FASTLZ_COMPRESS_BOUND(batch->block_size) ) + 1);
+  if (!data || !out || fread(data, 1, fsize, in) != fsize
+      || fgetc(in) != EOF)
+    {
+      fclose(in);
+      FREE(data);
+      FREE(out);
+      return PACK_ITEM_SERIAL;
+    }
+
+  fclose(in);
+
+  /* Chunks as pack_file_compressed writes them: tiny blocks are stored */
+  item->length = 0;
+  for (done = 0; done < fsize; done += batch->block_size)
+    {
+      unsigned long    bytes    = fsize - done < (unsigned long)batch->
+        block_size ? (unsigned long)( fsize - done )
+                   : (unsigned long)batch->block_size;
+      unsigned char *  chunk    = out + item->length;
+      unsigned long    size;
+
+      if (bytes < 32)
+        {
+          memcpy(chunk + 16, data + done, bytes);
+          size = bytes;
+        }
+      else
+        {
+          size = fastlz_compress_level(batch->level, data + done, (int)bytes,
+                                       chunk + 16);
+        }
+
+      put_chunk_header(chunk, 17, bytes < 32 ? 0 : 1, size,
+                       update_adler32(1L, chunk + 16, size), bytes);
+      item->length += 16 + size;
+    }
+
+  FREE(data);
+  item->size    = fsize;
+  item->chunks  = out;
+  return PACK_ITEM_READY;
+}
+
+static void *
+pack_batch_worker(void *arg)
+{
+  pack_batch * batch = (pack_batch *)arg;
+
+  pthread_mutex_lock(&batch->lock);
+  for (;;)
+    {
+      pack_item * item;
+
+      while (batch->taken == batch->added && !batch->stop)
+        {
+          pthread_cond_wait(&batch->cond, &batch->lock);
+        }
+
+      if (batch->stop)
+        {
+          break;
+        }
+
+      item = &batch->items[batch->taken++ % batch->count];
+      if (item->state == PACK_ITEM_WAITING)
+        {
+          int state;
+
+          pthread_mutex_unlock(&batch->lock);
+          state = pack_item_compress(batch, item);
+          pthread_mutex_lock(&batch->lock);
+          item->state = state;
+          pthread_cond_broadcast(&batch->cond);
+        }
+    }
+
+  pthread_mutex_unlock(&batch->lock);
+  return NULL;
+}
+
+/* Little endian, in length bytes */
+static unsigned long
+read_le(const unsigned char *ptr, int length)
+{
+  unsigned long value = 0;
+
+  while (length-- > 0)
+    {
+      value = ( value << 8 ) + ptr[length];
+    }
+
+  return value;
+}
+
+/* Write the chunks of a compressed item, as pack_member_now would */
+static void
+pack_item_write(pack_archive *archive, pack_item *item)
+{
+  sixpack_off    position  = archive->index.position;
+  sixpack_off    total;
+  unsigned long  percent   = 0;
+  unsigned long  done;
+
+  total = write_file_entry(archive->out, &archive->index, item->size, 0,
+                           item->name);
+  show_name(item->name);
+  for (done = 0; done < item->length; )
+    {
+      unsigned long size = read_le(item->chunks + done + 4, 4);
+
+      pack_index_add(&archive->index, size,
+                     read_le(item->chunks + done + 12, 4));
+      done += 16 + size;
+    }
+
+  sixpack_io_write(archive->out, item->chunks, item->length);
+  total += item->length;
+  show_progress(item->size, item->size, &percent);
+  show_saved(total, item->size);
+  pack_directory_add(&archive->directory, position, archive->index.offset,
+                     item->name);
+}
+
+/*
+ * Write the items that are done, in order, then wait for more until at
+ * most pending items are left. Returns 0, or -1 if a file failed.
+ */
+
+static int
+pack_batch_drain(pack_archive *archive, unsigned long pending)
+{
+  pack_batch * batch   = archive->batch;
+  int          result  = 0;
+
+  pthread_mutex_lock(&batch->lock);
+  while (batch->written < batch->added && result == 0)
+    {
+      pack_item * item = &batch->items[batch->written % batch->count];
+
+      if (item->state == PACK_ITEM_WAITING)
+        {
+          if (batch->added - batch->written <= pending)
+            {
+              break;
+            }
+
+          pthread_cond_wait(&batch->cond, &batch->lock);
+          continue;
+        }
+
+      pthread_mutex_unlock(&batch->lock);
+      if (item->state == PACK_ITEM_READY)
+        {
+          pack_item_write(archive, item);
+        }
+      else
+        {
+          result = pack_member_now(archive, item->path, item->name);
+        }
+
+      FREE(item->path);
+      FREE(item->name);
+      FREE(item->chunks);
+      pthread_mutex_lock(&batch->lock);
+      batch->written++;
+    }
+
+  pthread_mutex_unlock(&batch->lock);
+  return result;
+}
+
+/* Queue a file for the workers, once there is room for it */
+static int
+pack_batch_add(pack_archive *archive, const char *input_file,
+               const char *name)
+{
+  pack_batch * batch = archive->batch;
+  pack_item *  item;
+
+  if (pack_batch_drain(archive, batch->count - 1) < 0)
+    {
+      return -1;
+    }
+
+  item = &batch->items[batch->added % batch->count];
+  memset(item, 0, sizeof( pack_item ));
+  item->path  = (char *)malloc(strlen(input_file) + 1);
+  item->name  = (char *)malloc(strlen(name) + 1);
+  if (!item->path || !item->name)
+    {
+      FREE(item->path);
+      FREE(item->name);
+      printf("Error: not enough memory!\n");
+      return -1;
+    }
+
+  strcpy(item->path, input_file);
+  strcpy(item->name, name);
+  item->state = strcmp(input_file, "-") ? PACK_ITEM_WAITING
+                                        : PACK_ITEM_SERIAL;
+
+  pthread_mutex_lock(&batch->lock);
+  batch->added++;
+  pthread_cond_broadcast(&batch->cond);
+  pthread_mutex_unlock(&batch->lock);
+  return 0;
+}
+
+/* Start threads workers. Returns NULL if they can not be started. */
+static pack_batch *
+pack_batch_create(int threads, int level, int block_size)
+{
+  pack_batch * batch = (pack_batch *)calloc(1, sizeof( pack_batch ));
+
+  if (!batch)
+    {
+      return NULL;
+    }
+
+  batch->count       = (unsigned long)threads * SIXPACK_BATCH_DEPTH;
+  batch->level       = level;
+  batch->block_size  = block_size;
+  batch->items       = (pack_item *)calloc(batch->count, sizeof( pack_item ));
+  batch->workers     = (pthread_t *)calloc(threads, sizeof( pthread_t ));
+  if (!batch->items || !batch->workers)
+    {
+      FREE(batch->items);
+      FREE(batch->workers);
+      FREE(batch);
+      return NULL;
+    }
+
+  pthread_mutex_init(&batch->lock, NULL);
+  pthread_cond_init(&batch->cond, NULL);
+  for (; batch->threads < threads; batch->threads++)
+    {
+      if (pthread_create(&batch->workers[batch->threads], NULL,
+                         pack_batch_worker, batch) != 0)
+        {
+          break;
+        }
+    }
+
+  /* Fewer workers only mean less overlap; none would stall the batch */
+  if (batch->threads == 0)
+    {
+      pthread_mutex_destroy(&batch->lock);
+      pthread_cond_destroy(&batch->cond);
+      FREE(batch->items);
+      FREE(batch->workers);
+      free(batch);
+      return NULL;
+    }
+
+  return batch;
+}
+
+/* Stop the workers, and drop the items that were not written */
+static void
+pack_batch_destroy(pack_batch *batch)
+{
+  int i;
+
+  pthread_mutex_lock(&batch->lock);
+  batch->stop = 1;
+  pthread_cond_broadcast(&batch->cond);
+  pthread_mutex_unlock(&batch->lock);
+  for (i = 0; i < batch->threads; i++)
+    {
+      pthread_join(batch->workers[i], NULL);
+    }
+
+  for (; batch->written < batch->added; batch->written++)
+    {
+      pack_item * item = &batch->items[batch->written % batch->count];
+
+      FREE(item->path);
+      FREE(item->name);
+      FREE(item->chunks);
+    }
+
+  pthread_mutex_destroy(&batch->lock);
+  pthread_cond_destroy(&batch->cond);
+  FREE(batch->items);
+  FREE(batch->workers);
+  FREE(batch);
+}
+
+#endif /* if defined( SIXPACK_THREADS ) */
+
+/* Pack one file, as name if not NULL, and list it in the directory */
+static int
+pack_member(pack_archive *archive, const char *input_file, const char *name)
+{
+  if (!name)
+    {
+      name = strcmp(input_file, "-") ? base_name(input_file) : "stdin";
+    }
+
+  if (strlen(name) > 65534)
+    {
+      printf("Error: the name of %s is too long\n", input_file);
+      return -1;
+    }
+
+#if defined( SIXPACK_THREADS )
+  if (archive->batch)
+    {
+      return pack_batch_add(archive, input_file, name);
+    }
+#endif /* if defined( SIXPACK_THREADS ) */
+
+  return pack_member_now(archive, input_file, name);
+}
+
+#if defined( SIXPACK_DIRS )
+
+static int
+pack_compare_names(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Pack path as name, or if it is a directory, every file below it with
+ * name, a slash and their path in it as their names ("" for no prefix).
+ * Entries are taken in the order of their names, so that the archive does
+ * not depend on the order of the file system. Below a directory, only
+ * regular files (or links to them) and directories are taken; links to
+ * directories are only followed if given on the command line (follow),
+ * and 6pack archives found there are left out, like the archive itself.
+ */
+
+static int
+pack_tree(pack_archive *archive, const char *path, const char *name,
+          int follow)
+{
+  struct stat      st;
+  FILE *           in;
+  DIR *            dir;
+  struct dirent *  entry;
+  char **          names    = NULL;
+  unsigned long    count    = 0;
+  unsigned long    capacity = 0;
+  unsigned long    i;
+  int              result   = 0;
+
+  if (( follow ? stat(path, &st) : lstat(path, &st) ) < 0
+      || !S_ISDIR(st.st_mode))
+    {
+      if (!follow && ( stat(path, &st) < 0 || !S_ISREG(st.st_mode) ))
+        {
+          printf("Skipped %s, not a regular file\n", path);
+          return 0;
+        }
+
+      if (!follow && ( in = fopen(path, "rb") ) != NULL)
+        {
+          int archived = detect_magic(in);
+
+          fclose(in);
+          if (archived)
+            {
+              printf("Skipped %s, already a 6pack archive\n", path);
+              return 0;
+            }
+        }
+
+      if (stat(path, &st) == 0 && archive->known
+          && st.st_dev == archive->device && st.st_ino == archive->inode)
+        {
+          printf("Skipped %s, the archive itself\n", path);
+          return 0;
+        }
+
+      return pack_member(archive, path, *name ? name : NULL);
+    }
+
+  dir = opendir(path);
+  if (!dir)
+    {
+      printf("Error: could not open directory %s\n", path);
+      return -1;
+    }
+
+  while (( entry = readdir(dir) ) != NULL)
+    {
+      if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+        {
+          continue;
+        }
+
+      if (count == capacity)
+        {
+          char **more;
+
+          capacity  = capacity ? 2 * capacity : 64;
+          more      = (char **)realloc(names, capacity * sizeof(char *));
+          if (!more)
+            {
+              result = -1;
+              break;
+            }
+
+          names = more;
+        }
+
+      names[count] = (char *)malloc(strlen(entry->d_name) + 1);
+      if (!names[count])
+        {
+          result = -1;
+          break;
+        }
+
+      strcpy(names[count++], entry->d_name);
+    }
+
+  closedir(dir);
+  if (result < 0)
+    {
+      printf("Error: not enough memory!\n");
+    }
+  else if (count > 1)
+    {
+      qsort(names, count, sizeof(char *), pack_compare_names);
+    }
+
+  for (i = 0; i < count; i++)
+    {
+      size_t  length  = strlen(path);
+      char *  child   = (char *)malloc(length + strlen(names[i]) + 2);
+      char *  label   = (char *)malloc(strlen(name) + strlen(names[i]) + 2);
+
+      if (result == 0 && child && label)
+        {
+          strcpy(child, path);
+          if (length > 0 && path[length - 1] != PATH_SEPARATOR)
+            {
+              child[length++] = PATH_SEPARATOR;
+            }
+
+          strcpy(child + length, names[i]);
+          strcpy(label, name);
+          if (*name)
+            {
+              strcat(label, "/");
+            }
+
+          strcat(label, names[i]);
+          result = pack_tree(archive, child, label, 0);
+        }
+      else if (result == 0)
+        {
+          printf("Error: not enough memory!\n");
+          result = -1;
+        }
+
+      FREE(child);
+      FREE(label);
+      FREE(names[i]);
+    }
+
+  FREE(names);
+  return result;
+}
+
+/*
+ * Name of a directory given on the command line in the archive: its last
+ * component, without trailing separators, or "" for . or the root.
+ */
+
+static char *
+pack_tree_name(const char *path)
+{
+  size_t        length  = strlen(path);
+  const char *  start;
+  char *        name;
+
+  while (length > 0 && path[length - 1] == PATH_SEPARATOR)
+    {
+      length--;
+    }
+
+  for (start = path + length; start > path; start--)
+    {
+      if (*( start - 1 ) == PATH_SEPARATOR)
+        {
+          break;
+        }
+    }
+
+  length  -= start - path;
+  name     = (char *)malloc(length + 1);
+  if (name)
+    {
+      memcpy(name, start, length);
+      name[length] = 0;
+      if (!strcmp(name, ".") || !strcmp(name, ".."))
+        {
+          name[0] = 0;
+        }
+    }
+
+  return name;
+}
+
+#endif /* if defined( SIXPACK_DIRS ) */
+
+int
+pack_file(int compress_level, int threads, int block_size, int io_flags,
+          int seekable, char **input_files, int inputs,
+          const char *output_file)
+{
+  FILE *        f;
+  pack_archive  archive;
+  int           result;
+  int           i;
+
+  if (!output_file)
+    {
+      printf("Error: invalid output file. Aborted.\n\n");
+      return -1;
+    }
+
+  /* The archive may go to standard output */
+  if (!strcmp(output_file, "-"))
+    {
+      f = sixpack_io_stdout();
+      output_file = "stdout";
+    }
+  else
+    {
+      f = fopen(output_file, "rb");
+      if (f)
+        {
+          fclose(f);
+          printf("Error: file %s already exists. Aborted.\n\n",
+                 output_file);
+          return -1;
+        }
+
+      f = fopen(output_file, "wb");
+    }
+
+  if (!f)
+    {
+      printf("Error: could not create %s. Aborted.\n\n", output_file);
+      return -1;
+    }
+
+  memset(&archive, 0, sizeof( pack_archive ));
+  archive.level       = compress_level;
+  archive.threads     = threads;
+  archive.block_size  = block_size;
+  archive.io_flags    = io_flags;
+#if defined( SIXPACK_DIRS )
+  {
+    struct stat st;
+
+    if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode))
+      {
+        archive.known   = 1;
+        archive.device  = st.st_dev;
+        archive.inode   = st.st_ino;
+      }
+  }
+#endif /* if defined( SIXPACK_DIRS ) */
+
+  /* Chunks are written behind, while the next blocks are compressed */
+  archive.out = sixpack_io_writer(f, SIXPACK_IO_WRITE_BLOCK,
+                                  SIXPACK_IO_DEPTH, io_flags);
+  if (!archive.out)
+    {
+      fclose(f);
+      printf("Error: not enough memory!\n");
+      return -1;
+    }
+
+  if (( io_flags & SIXPACK_IO_DIRECT ) && !sixpack_io_direct(archive.out))
+    {
+      printf("Note: --direct is not possible for %s, it goes through the "
+             "page cache\n", output_file);
+    }
+
+  write_magic(archive.out);
+  archive.index.position = 8;
+
+#if defined( SIXPACK_THREADS )
+  /* Small files are compressed ahead by the workers, unless --direct */
+  if (threads > 0 && !( io_flags & SIXPACK_IO_DIRECT ))
+    {
+      archive.batch = pack_batch_create(threads, compress_level, block_size);
+    }
+#endif /* if defined( SIXPACK_THREADS ) */
+
+  for (i = 0, result = 0; i < inputs && result == 0; i++)
+    {
+#if defined( SIXPACK_DIRS )
+      char *name = strcmp(input_files[i], "-") ? pack_tree_name(
+        input_files[i]) : NULL;
+
+      if (name)
+        {
+          result = pack_tree(&archive, input_files[i], name, 1);
+          FREE(name);
+          continue;
+        }
+#endif /* if defined( SIXPACK_DIRS ) */
+      result = pack_member(&archive, input_files[i], NULL);
+    }
+
+#if defined( SIXPACK_THREADS )
+  if (archive.batch)
+    {
+      if (result == 0)
+        {
+          result = pack_batch_drain(&archive, 0);
+        }
+
+      pack_batch_destroy(archive.batch);
+    }
+#endif /* if defined( SIXPACK_THREADS ) */
+
+  if (result == 0
+      && pack_tail_write(&archive.index, &archive.directory, seekable,
+                         archive.out) < 0)
+    {
+      printf("Error: could not write the %s!\n",
+             seekable ? "block index and directory" : "directory");
+      result = -1;
+    }
+
+  FREE(archive.index.entries);
+  FREE(archive.directory.entries);
+  if (sixpack_io_close(archive.out) < 0 && result == 0)
+    {
+      printf("Error: writing %s failed!\n", output_file);
+      result = -1;
+    }
+
+  fclose(f);
+
+  return result;
+}
+
+#if defined( SIXPACK_THREADS )
+
+/*
+ * Benchmark of the pool with -mem -T N: clients threads each compress
+ * their share of the file block by block, either with direct calls of
+ * fastlz_compress_level or as jobs submitted to a shared pool, until the
+ * time is up. Throughput is measured in wall-clock time, as clock() adds
+ * up the time of all threads.
+ */
+
+typedef struct bench_client
+{
+  fastlz_pool *          pool;      /* NULL for direct calls */
+  int                    level;
+  int                    block_size;
+  const unsigned char *  input;
+  unsigned long          length;
+  unsigned long          blocks;
+  unsigned char *        output;
+  fastlz_job *           jobs;
+  unsigned long          deadline;
+  double                 done;      /* bytes compressed */
+} bench_client;
+
+static unsigned long
+bench_wall_ticks(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (unsigned long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void *
+bench_client_run(void *arg)
+{
+  bench_client *  client  = (bench_client *)arg;
+  unsigned long   maxout  = FASTLZ_COMPRESS_BOUND(client->block_size);
+  unsigned long   b;
+
+  while (bench_wall_ticks() < client->deadline)
+    {
+      for (b = 0; b < client->blocks; b++)
+        {
+          unsigned long  offset  = b * client->block_size;
+          int            length  = client->length - offset
+                                   < (unsigned long)client->block_size
+                                   ? (int)( client->length - offset )
+                                   : client->block_size;
+
+          if (client->pool)
+            {
+              fastlz_job *job = &client->jobs[b];
+
+              memset(job, 0, sizeof( fastlz_job ));
+              job->op      = FASTLZ_JOB_COMPRESS;
+              job->level   = client->level;
+              job->input   = client->input + offset;
+              job->length  = length;
+              job->output  = client->output + b * maxout;
+              fastlz_pool_submit(client->pool, job);
+            }
+          else
+            {
+              fastlz_compress_level(client->level, client->input + offset,
+                                    length, client->output + b * maxout);
+            }
+        }
+
+      for (b = 0; client->pool && b < client->blocks; b++)
+        {
+          fastlz_pool_wait(client->pool, &client->jobs[b]);
+        }
+
+      client->done += (double)client->length;
+    }
+
+  return NULL;
+}
+
+/* Throughput of clients threads, in Mbyte/s, or a negative value */
+static double
+bench_clients(fastlz_pool *pool, int clients, int level, int block_size,
+              const unsigned char *buffer, unsigned long length)
+{
+  bench_client *  client  = (bench_client *)calloc(clients,
+                                                   sizeof( bench_client ));
+  pthread_t *     thread  = (pthread_t *)calloc(clients, sizeof( pthread_t ));
+  unsigned long   start;
+  unsigned long   slice   = length / clients;
+  double          done    = 0.;
+  int             started = 0;
+  int             c;
+
+  for (c = 0; client && thread && c < clients; c++)
+    {
+      client[c].pool        = pool;
+      client[c].level       = level;
+      client[c].block_size  = block_size;
+      client[c].input       = buffer + c * slice;
+      client[c].length      = c == clients - 1 ? length - c * slice : slice;
+      client[c].blocks      = ( client[c].length + block_size - 1 )
+                              / block_size;
+      client[c].output      = (unsigned char *)malloc(
+        client[c].blocks * FASTLZ_COMPRESS_BOUND(block_size) + 1);
+      client[c].jobs        = (fastlz_job *)malloc(
+        client[c].blocks * sizeof( fastlz_job ) + 1);
+      if (!client[c].output || !client[c].jobs)
+        {
+          break;
+        }
+    }
+
+  if (client && thread && c == clients)
+    {
+      start = bench_wall_ticks();
+      for (c = 0; c < clients; c++)
+        {
+          client[c].deadline = start + 3000;
+        }
+
+      for (started = 0; started < clients; started++)
+        {
+          if (pthread_create(&thread[started], NULL, bench_client_run,
+                             &client[started]) != 0)
+            {
+              break;
+            }
+        }
+
+      for (c = 0; c < started; c++)
+        {
+          pthread_join(thread[c], NULL);
+          done += client[c].done;
+        }
+
+      done = done / ((double)( bench_wall_ticks() - start ) / 1000. )
+             / 1000000.;
+    }
+
+  for (c = 0; client && c < clients; c++)
+    {
+      FREE(client[c].output);
+      FREE(client[c].jobs);
+    }
+
+  FREE(client);
+  FREE(thread);
+  return started == clients ? done : -1.;
+}
+
+/* Compare direct calls and the pool, with 1 and threads clients */
+static void
+benchmark_pool(int compress_level, int threads, int block_size,
+               const unsigned char *buffer, unsigned long length)
+{
+  int c;
+
+  printf("Benchmarking the pool with blocks of %d bytes, please wait...\n",
+         block_size);
+  for (c = 1; c <= threads; c = c < threads ? threads : threads + 1)
+    {
+      fastlz_pool * pool = fastlz_pool_create(c);
+
+      printf("  direct calls, %3d client(s):    %.1f Mbyte/s\n", c,
+             bench_clients(NULL, c, compress_level, block_size, buffer,
+                           length));
+      if (pool)
+        {
+          printf("  pool of %3d, %3d client(s):     %.1f Mbyte/s\n", c, c,
+                 bench_clients(pool, c, compress_level, block_size, buffer,
+                               length));
+          fastlz_pool_destroy(pool);
+        }
+    }
+
+  printf("\n");
+}
+
+#endif /* if defined( SIXPACK_THREADS ) */
+
+/*
+ * Benchmark of fastlz_transcode with -mem: the file is compressed block by
+ * block at the given level, then each block is converted to the other level,
+ * either with fastlz_transcode or by decompressing and compressing it again.
+ * Both are timed for about 3 seconds and measured against the file size.
+ */
+
+static double
+bench_transcode_run(int direct, int level, int block_size,
+                    const unsigned char *packed, const int *packed_size,
+                    unsigned long blocks, unsigned char *output,
+                    unsigned char *scratch, int maxscratch,
+                    unsigned long length, unsigned long *converted)
+{
+  unsigned long  maxout  = FASTLZ_COMPRESS_BOUND(block_size);
+  unsigned long  start, b;
+  double         done    = 0.;
+
+  start = SIXPACK_TICKS();
+  while (SIXPACK_TICKS() - start < 3000)
+    {
+      *converted = 0;
+      for (b = 0; b < blocks; b++)
+        {
+          const unsigned char *  block  = packed + b * maxout;
+          int                    size;
+
+          if (direct)
+            {
+              size = fastlz_transcode(level, block, packed_size[b], output,
+                                      scratch, maxscratch);
+            }
+          else
+            {
+              size = fastlz_decompress(block, packed_size[b], scratch,
+                                       block_size);
+              size = size > 0 ? fastlz_compress_level(level, scratch, size,
+                                                      output)
+                              : size;
+            }
+
+          if (size < 0)
+            {
+              return -1.;
+            }
+
+          *converted += size;
+        }
+
+      done += (double)length;
+    }
+
+  return done / ((double)( SIXPACK_TICKS() - start ) / 1000. ) / 1000000.;
+}
+
+/* Compare fastlz_transcode with decompressing and compressing again */
+static void
+benchmark_transcode(int compress_level, int block_size,
+                    const unsigned char *buffer, unsigned long length)
+{
+  int              level       = compress_level == 1 ? 2 : 1;
+  unsigned long    maxout      = FASTLZ_COMPRESS_BOUND(block_size);
+  unsigned long    blocks      = ( length + block_size - 1 ) / block_size;
+  int              maxscratch  = FASTLZ_TRANSCODE_SCRATCH_SIZE(block_size);
+  unsigned char *  packed      = (unsigned char *)malloc(blocks * maxout + 1);
+  int *            packed_size = (int *)malloc(blocks * sizeof( int ) + 1);
+  unsigned char *  output      = (unsigned char *)malloc(maxout);
+  unsigned char *  scratch     = (unsigned char *)malloc(maxscratch);
+  unsigned long    b, converted;
+  double           mbs;
+
+  if (!packed || !packed_size || !output || !scratch)
+    {
+      printf("Error: not enough memory!\n");
+      FREE(packed);
+      FREE(packed_size);
+      FREE(output);
+      FREE(scratch);
+      return;
+    }
+
+  printf("Benchmarking transcoding of %d-byte blocks from level %d to %d, "
+         "please wait...\n", block_size, compress_level, level);
+  for (b = 0; b < blocks; b++)
+    {
+      unsigned long  offset  = b * block_size;
+
+      packed_size[b] = fastlz_compress_level(
+        compress_level,
+        buffer + offset,
+        length - offset < (unsigned long)block_size
+        ? (int)( length - offset ) : block_size,
+        packed + b * maxout);
+    }
+
+  mbs = bench_transcode_run(1, level, block_size, packed, packed_size,
+                            blocks, output, scratch, maxscratch, length,
+                            &converted);
+  printf("  fastlz_transcode:               %.1f Mbyte/s, %lu bytes\n",
+         mbs, converted);
+  mbs = bench_transcode_run(0, level, block_size, packed, packed_size,
+                            blocks, output, scratch, maxscratch, length,
+                            &converted);
+  printf("  decompress and compress again:  %.1f Mbyte/s, %lu bytes\n",
+         mbs, converted);
+
+  FREE(packed);
+  FREE(packed_size);
+  FREE(output);
+  FREE(scratch);
+}
+
+/* Largest file benchmarked, compressed as one block of the int API */
+#define BENCHMARK_FILE_MAX  1073741824
+
+int benchmark_speed(int compress_level, int threads, int block_size,
+                    const char *input_file);
+
+int
+benchmark_speed(int compress_level, int threads, int block_size,
+                const char *input_file)
+{
+  FILE *          in;
+  sixpack_off     fsize;
+  size_t          maxout;
+  const char *    shown_name;
+  unsigned char * buffer;
+  unsigned char * result;
+  size_t          bytes_read;
+
+  /* sanity check */
+  in = fopen(input_file, "rb");
+  if (!in)
+    {
+      printf("Error: could not open %s\n", input_file);
+      return -1;
+    }
+
+  /* find size of the file, read whole into memory */
+  if (sixpack_io_size(in, &fsize) < 0 || fsize > BENCHMARK_FILE_MAX)
+    {
+      printf("Error: no benchmark for %s, not a file of up to %dM!\n",
+             input_file, BENCHMARK_FILE_MAX >> 20);
+      fclose(in);
+      return -1;
+    }
+
+  /* already a 6pack archive? */
+  if (detect_magic(in))
+    {
+      printf("Error: no benchmark for 6pack archive!\n");
+      fclose(in);
+      return -1;
+    }
+
+  /* Truncate directory prefix, e.g. "foo/bar/FILE.txt" becomes "FILE.txt" */
+  shown_name = input_file + strlen(input_file) - 1;
+  while (shown_name > input_file)
+    {
+      if (*( shown_name - 1 ) == PATH_SEPARATOR)
+        {
+          break;
+        }
+      else
+        {
+          shown_name--;
+        }
+    }
+
+  maxout  = FASTLZ_COMPRESS_BOUND((size_t)fsize);
+  buffer  = (unsigned char *)malloc((size_t)fsize);
+  result  = (unsigned char *)malloc(maxout);
+  if (!buffer || !result)
+    {
+      printf("Error: not enough memory!\n");
+      FREE(buffer);
+      FREE(result);
+      fclose(in);
+      return -1;
+    }
+
+  printf("Reading source file....\n");
+  bytes_read = fread(buffer, 1, (size_t)fsize, in);
+  if (bytes_read != fsize)
+    {
+      printf("Error reading file %s!\n", shown_name);
+      printf("Read %lu bytes, expecting %lu bytes\n",
+             (unsigned long)bytes_read, (unsigned long)fsize);
+      FREE(buffer);
+      FREE(result);
+      fclose(in);
+      return -1;
+    }
+
+  /* shamelessly copied from QuickLZ 1.20 test program */
+  {
+    unsigned int   j, y;
+    size_t         i, u = 0;
+    double         mbs, fastest;
+    unsigned long  compressed_size;
+
+#if defined( SIXPACK_BENCHMARK_WIN32 )
+      printf("Setting HIGH_PRIORITY_CLASS...\n");
+      SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
+#endif /* if defined( SIXPACK_BENCHMARK_WIN32 ) */
+
+    printf("Benchmarking FastLZ Level %d, please wait...\n", compress_level);
+
+    i        = bytes_read;
+    fastest  = 0.0;
+    for (j = 0; j < 3; j++)
+      {
+        y    = 0;
+        mbs  = SIXPACK_TICKS();
+        while (SIXPACK_TICKS() == mbs)
+          {
+            ;
+          }
+        mbs = SIXPACK_TICKS();
+        while (SIXPACK_TICKS() - mbs < 3000) /* 1% accuracy with 18.2 timer */
+          {
+            u = fastlz_compress_level(
+              compress_level,
+              buffer,
+              bytes_read,
+              result);
+            y++;
+          }
+
+        mbs = ((double)i * (double)y )
+              / ((double)( SIXPACK_TICKS() - mbs ) / 1000. ) / 1000000.;
+        /*printf(" %.1f Mbyte/s  ", mbs);*/
+        if (fastest < mbs)
+          {
+            fastest = mbs;
+          }
+      }
+
+    printf(
+      "\nCompressed %d bytes into %d bytes (%.1f%%) at %.1f Mbyte/s.\n",
+      (unsigned int)i,
+      (unsigned int)u,
+      (double)u / (double)i * 100.,
+      fastest);
+
+#if 1
+      fastest          = 0.0;
+      compressed_size  = u;
+      for (j = 0; j < 3; j++)
+        {
+          y    = 0;
+          mbs  = SIXPACK_TICKS();
+          while (SIXPACK_TICKS() == mbs)
+            {
+              ;
+            }
+          mbs = SIXPACK_TICKS();
+          while (SIXPACK_TICKS() - mbs < 3000) /* 1% accuracy with 18.2 timer */
+            {
+              u = fastlz_decompress(
+                result,
+                compressed_size,
+                buffer,
+                bytes_read);
+              y++;
+            }
+
+          mbs = ((double)i * (double)y )
+                / ((double)( SIXPACK_TICKS() - mbs ) / 1000. ) / 1000000.;
+          /*printf(" %.1f Mbyte/s  ", mbs);*/
+          if (fastest < mbs)
+            {
+              fastest = mbs;
+            }
+        }
+
+      printf(
+        "\nDecompressed at %.1f Mbyte/s.\n\n(1 MB = 1000000 byte)\n",
+        fastest);
+#endif /* if 1 */
+  }
+
+  if (bytes_read > 0)
+    {
+      printf("\n");
+      benchmark_transcode(compress_level, block_size, buffer, bytes_read);
+    }
+
+#if defined( SIXPACK_THREADS )
+  if (threads > 0 && bytes_read > 0)
+    {
+      printf("\n");
+      benchmark_pool(compress_level, threads, block_size, buffer, bytes_read);
+    }
+#else  /* if defined( SIXPACK_THREADS ) */
+  (void)threads;
+  (void)block_size;
+#endif /* if defined( SIXPACK_THREADS ) */
+
+  FREE(buffer);
+  FREE(result);
+  fclose(in);
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  int    i;
+  int    compress_level;
+  int    benchmark;
+  int    threads;
+  int    io_flags;
+  int    block_size;
+  int    seekable;
+  int    files;
+  char **file_names;
+
+  /* Show help with no argument at all*/
+  if (argc == 1)
+    {
+      usage();
+      return 0;
+    }
+
+  /* Default compression level, not the fastest */
+  compress_level = 2;
+
+  /* Do benchmark only when explicitly specified */
+  benchmark = 0;
+
+  /* Single-threaded unless -T is given */
+  threads = 0;
+
+  /* Through the page cache unless --direct is given */
+  io_flags = 0;
+
+  /* Built-in block size unless -B is given */
+  block_size = BLOCK_SIZE;
+
+  /* No block index unless --index is given */
+  seekable = 0;
+
+  /* No file is specified; the last one will be the output */
+  files       = 0;
+  file_names  = (char **)malloc(argc * sizeof(char *));
+  if (!file_names)
+    {
+      printf("Error: not enough memory!\n");
+      return -1;
+    }
+
+  for (i = 1; i <= argc; i++)
+    {
+      char *argument = argv[i];
+
+      if (!argument)
+        {
+          continue;
+        }
+
+      /* Display help on usage */
       if (!strcmp(argument, "-h") || !strcmp(argument, "--help"))
         {
           usage();
@@ -714,37 +2554,93 @@ main(int argc, char **argv)
           continue;
         }
 
-      /* Unknown option */
-      if (argument[0] == '-')
+      /* Block size, as -B N or -BN, with an optional K or M suffix */
+      if (!strncmp(argument, "-B", 2))
         {
-          printf("Error: unknown option %s\n\n", argument);
+          const char *    size  = argument[2] ? argument + 2 : argv[++i];
+          char *          end   = NULL;
+          unsigned long   n     = size ? strtoul(size, &end, 10) : 0;
+
+          /* Checked before the shift, which could wrap a 32-bit long */
+          if (end && ( *end == 'K' || *end == 'k' ))
+            {
+              n = n <= BLOCK_SIZE_MAX >> 10 ? n << 10 : 0;
+              end++;
+            }
+          else if (end && ( *end == 'M' || *end == 'm' ))
+            {
+              n = n <= BLOCK_SIZE_MAX >> 20 ? n << 20 : 0;
+              end++;
+            }
+
+          if (end && *end == 0 && n >= 256 && n <= BLOCK_SIZE_MAX)
+            {
+              block_size = (int)n;
+              continue;
+            }
+
+          printf("Error: -B needs a block size from 256 to %dM\n\n",
+                 BLOCK_SIZE_MAX >> 20);
           printf("To get help on usage:\n");
           printf("  6pack --help\n\n");
           return -1;
         }
 
-      /* First specified file is input */
-      if (!input_file)
+      /* Seekable archive, with a block index at the end */
+      if (!strcmp(argument, "--index"))
         {
-          input_file = argument;
+          seekable = 1;
           continue;
         }
 
-      /* Next specified file is output */
-      if (!output_file)
+      /* Bypass the page cache */
+      if (!strcmp(argument, "--direct"))
         {
-          output_file = argument;
+          io_flags |= SIXPACK_IO_DIRECT;
           continue;
         }
 
-      /* Files are already specified */
-      printf("Error: unknown option %s\n\n", argument);
-      printf("To get help on usage:\n");
-      printf("  6pack --help\n\n");
-      return -1;
+      /* Number of compression threads, as -T N or -TN */
+      if (!strncmp(argument, "-T", 2))
+        {
+          const char *  count  = argument[2] ? argument + 2 : argv[++i];
+#if defined( SIXPACK_THREADS )
+          char *        end    = NULL;
+          long          n      = count ? strtol(count, &end, 10) : 0;
+
+          /* A number and nothing else, e.g. not 4x */
+          if (end && end != count && *end == 0 && n >= 1
+              && n <= FASTLZ_POOL_MAX_THREADS)
+            {
+              threads = (int)n;
+              continue;
+            }
+
+          printf("Error: -T needs a thread count from 1 to %d\n\n",
+                 FASTLZ_POOL_MAX_THREADS);
+#else  /* if defined( SIXPACK_THREADS ) */
+          (void)count;
+          printf("Error: -T is not supported by this build\n\n");
+#endif /* if defined( SIXPACK_THREADS ) */
+          printf("To get help on usage:\n");
+          printf("  6pack --help\n\n");
+          return -1;
+        }
+
+      /* Unknown option; a lone - is standard input or output */
+      if (argument[0] == '-' && argument[1])
+        {
+          printf("Error: unknown option %s\n\n", argument);
+          printf("To get help on usage:\n");
+          printf("  6pack --help\n\n");
+          return -1;
+        }
+
+      /* Input files, then the output file */
+      file_names[files++] = argument;
     }
 
-  if (!input_file)
+  if (files == 0)
     {
       printf("Error: input file is not specified.\n\n");
       printf("To get help on usage:\n");
@@ -752,7 +2648,7 @@ main(int argc, char **argv)
       return -1;
     }
 
-  if (!output_file && !benchmark)
+  if (files == 1 && !benchmark)
     {
       printf("Error: output file is not specified.\n\n");
       printf("To get help on usage:\n");
@@ -760,15 +2656,14 @@ main(int argc, char **argv)
       return -1;
     }
 
-#ifdef SIXPACK_BENCHMARK_WIN32
-    if (benchmark)
-      {
-        return benchmark_speed(compress_level, input_file);
-      }
-    else
-#endif /* ifdef SIXPACK_BENCHMARK_WIN32 */
-  return pack_file(compress_level, input_file, output_file);
+  if (benchmark)
+    {
+      return benchmark_speed(compress_level, threads, block_size,
+                             file_names[0]);
+    }
 
-  /* unreachable */
-  return 0;
+  i = pack_file(compress_level, threads, block_size, io_flags, seekable,
+                file_names, files - 1, file_names[files - 1]);
+  FREE(file_names);
+  return i;
 }
@@ -26,6 +26,19 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+/* 64-bit file offsets, also on 32-bit systems */
+#if !defined( _FILE_OFFSET_BITS )
+# define _FILE_OFFSET_BITS  64
+#endif /* if !defined( _FILE_OFFSET_BITS ) */
+
+#if defined ( WIN32 )  || defined( __NT__ ) \
+  || defined( _WIN32 ) || defined( __WIN32__ )
+# define SIXPACK_WIN32
+#elif !defined( _DEFAULT_SOURCE )
+# define _DEFAULT_SOURCE  /* for madvise, posix_fallocate and mkdir */
+#endif /* if defined ( WIN32 )  || defined( __NT__ )
+           || defined( _WIN32 ) || defined( __WIN32__ ) */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -47,23 +60,68 @@
 #endif /* ifdef TESTING */
 
 #include "fastlz.h"
+#include "sixpack.h"
+#include "sixpack_io.h"
+
+/* Parallel decompression with -T, built with -DSIXPACK_THREADS */
+#if defined( SIXPACK_THREADS )
+# include <pthread.h>
+# include "fastlz_pool.h"
+#endif /* if defined( SIXPACK_THREADS ) */
+
+/* Decompression into a mapping of the output, built with -DSIXPACK_MMAP */
+#if defined( SIXPACK_MMAP )
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <unistd.h>
+#endif /* if defined( SIXPACK_MMAP ) */
+
+/* Directories in the names of the files */
+#if defined( SIXPACK_WIN32 )
+# include <direct.h>
+# define unpack_mkdir(path)  _mkdir((path))
+#else  /* if defined( SIXPACK_WIN32 ) */
+# include <sys/stat.h>
+# define unpack_mkdir(path)  mkdir((path), 0777)
+#endif /* if defined( SIXPACK_WIN32 ) */
 
 /* Magic identifier for 6pack file */
 static unsigned char sixpack_magic[8] = {
   137, '6', 'P', 'K', 13, 10, 26, 10
 };
 
-#ifndef BLOCK_SIZE
-# define BLOCK_SIZE  65536
-#endif /* ifndef BLOCK_SIZE */
+/* File entries of streamed input have all the bits of their size set */
+#define SIXPACK_SIZE_UNKNOWN  255
+
+/* Standard output, when every file is extracted to it; never closed early */
+static FILE *unpack_stdout = NULL;
+
+/*
+ * Largest file entry: its fixed fields and a name of up to 65535 bytes.
+ * Chunk buffers are sized from the chunk headers instead, so archives of
+ * any block size can be extracted.
+ */
+
+#define ENTRY_SIZE_MAX  ( 10 + 65535 )
+
+/* Archive reads ahead, large enough to span many chunks */
+#define READ_BLOCK  1048576
 
-#if ( BLOCK_SIZE > 2621440 )
-# error BLOCK_SIZE too large ( > 2621440 )
-#endif /* if ( BLOCK_SIZE > 2621440 */
+/*
+ * Sequential reader of the archive. Blocks are requested ahead through
+ * sixpack_io, so the I/O for the next chunks overlaps the decompression
+ * of the current one, and chunks are taken from the blocks without
+ * seeking.
+ */
 
-#if ( BLOCK_SIZE < 256 )
-# error BLOCK_SIZE too small ( < 256 )
-#endif /* if ( BLOCK_SIZE < 256 */
+typedef struct unpack_reader
+{
+  sixpack_io *          io;
+  const unsigned char * block;
+  size_t                length;
+  size_t                used;
+  sixpack_off           position;  /* in the archive */
+} unpack_reader;
 
 /* Prototypes */
 static unsigned long update_adler32(unsigned long checksum, const void *buf,
@@ -72,9 +130,13 @@ void usage(void);
 int detect_magic(FILE *f);
 static unsigned long readU16(const unsigned char *ptr);
 static unsigned long readU32(const unsigned char *ptr);
-void read_chunk_header(FILE *f, int *id, int *options, unsigned long *size,
-                       unsigned long *checksum, unsigned long *extra);
-int unpack_file(const char *archive_file);
+int read_chunk_header(unpack_reader *r, int *id, int *options,
+                      unsigned long *size, unsigned long *checksum,
+                      unsigned long *extra);
+int unpack_file(const char *archive_file, const char *member, int threads);
+int unpack_list(const char *archive_file);
+int unpack_range(const char *archive_file, const char *member,
+                 sixpack_off offset, sixpack_off length, int threads);
 
 /* Adler-32 checksum algorithm; see RFC-1950, Section 8.2 */
 #define ADLER32_BASE  65521
@@ -128,7 +190,19 @@ usage(void)
   printf("6unpack: uncompress 6pack archive\n");
   printf("Copyright (C) Ariya Hidayat\n");
   printf("\n");
-  printf("Usage: 6unpack archive-file\n");
+  printf("Usage: 6unpack [options] archive-file [-]\n");
+  printf("\n");
+  printf("Use - as archive-file to read standard input, and a second -\n");
+  printf("to extract the files to standard output.\n");
+  printf("\n");
+  printf("Options:\n");
+  printf("  -l                list the files in the archive\n");
+  printf("  -x NAME           extract only the file NAME\n");
+  printf("  -r OFFSET,LENGTH  write this range of the first file, or of\n");
+  printf("                    NAME, to standard output (6pack --index)\n");
+#if defined( SIXPACK_THREADS )
+  printf("  -T N              decompress with N threads\n");
+#endif /* if defined( SIXPACK_THREADS ) */
   printf("\n");
 }
 
@@ -172,29 +246,555 @@ readU16(const unsigned char *ptr)
 static unsigned long
 readU32(const unsigned char *ptr)
 {
-  return ptr[0] + ( ptr[1] << 8 ) + ( ptr[2] << 16 ) + ( ptr[3] << 24 );
+  return ptr[0] + ( ptr[1] << 8 ) + ( ptr[2] << 16 )
+         + ( (unsigned long)ptr[3] << 24 );
 }
 
-void
-read_chunk_header(FILE *f, int *id, int *options, unsigned long *size,
-                  unsigned long *checksum, unsigned long *extra)
+/* Refill the current block if it is used up; returns 0 at the end */
+static int
+unpack_refill(unpack_reader *r)
+{
+  if (r->used == r->length)
+    {
+      r->length  = sixpack_io_read(r->io, &r->block);
+      r->used    = 0;
+    }
+
+  return r->used < r->length;
+}
+
+/* Copy the next n bytes of the archive; returns the number copied */
+static size_t
+unpack_read(unpack_reader *r, void *dest, size_t n)
+{
+  unsigned char * p     = (unsigned char *)dest;
+  size_t          done  = 0;
+
+  while (done < n && unpack_refill(r))
+    {
+      size_t k = r->length - r->used < n - done ? r->length - r->used
+                                                : n - done;
+
+      memcpy(p + done, r->block + r->used, k);
+      r->used  += k;
+      done     += k;
+    }
+
+  r->position += done;
+  return done;
+}
+
+/*
+ * Next n bytes of the archive, in place if they are within one block and
+ * otherwise copied to scratch. Valid until the next read; *got is the
+ * number of bytes, less than n at the end of the archive.
+ */
+
+static const unsigned char *
+unpack_fetch(unpack_reader *r, size_t n, unsigned char *scratch, size_t *got)
+{
+  const unsigned char *p;
+
+  if (unpack_refill(r) && r->length - r->used >= n)
+    {
+      p             = r->block + r->used;
+      r->used      += n;
+      r->position  += n;
+      *got          = n;
+      return p;
+    }
+
+  *got = unpack_read(r, scratch, n);
+  return scratch;
+}
+
+/* Go forward to the given position in the archive */
+static void
+unpack_skip_to(unpack_reader *r, sixpack_off position)
+{
+  while (r->position < position && unpack_refill(r))
+    {
+      size_t k = r->length - r->used < position - r->position
+                   ? r->length - r->used
+                   : (size_t)( position - r->position );
+
+      r->used      += k;
+      r->position  += k;
+    }
+
+  r->position = position;
+}
+
+/* Returns 0 at the end of the archive, when no whole header is left */
+int
+read_chunk_header(unpack_reader *r, int *id, int *options,
+                  unsigned long *size, unsigned long *checksum,
+                  unsigned long *extra)
 {
   unsigned char buffer[16];
 
-  fread(buffer, 1, 16, f);
+  memset(buffer, 0, 16);
+  if (unpack_read(r, buffer, 16) < 16)
+    {
+      return 0;
+    }
 
   *id        = readU16(buffer)      & 0xffff;
   *options   = readU16(buffer + 2)  & 0xffff;
   *size      = readU32(buffer + 4)  & 0xffffffff;
   *checksum  = readU32(buffer + 8)  & 0xffffffff;
   *extra     = readU32(buffer + 12) & 0xffffffff;
+  return 1;
+}
+
+/*
+ * Size the new output file f from its file entry and map it, so that
+ * chunks are decompressed straight into the file. Returns NULL if the file
+ * can not be mapped; it is then written through a sixpack_io writer.
+ */
+
+static unsigned char *
+unpack_map_output(FILE *f, sixpack_off size)
+{
+#if defined( SIXPACK_MMAP )
+  void *  map;
+  int     fd = fileno(f);
+
+  if (size == 0 || (sixpack_off)(size_t)size != size)
+    {
+      return NULL;
+    }
+
+  /* Allocate the blocks up front; sparse if the file system can not */
+  if (posix_fallocate(fd, 0, (off_t)size) != 0
+      && ftruncate(fd, (off_t)size) != 0)
+    {
+      return NULL;
+    }
+
+  map = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    {
+      (void)ftruncate(fd, 0);
+      return NULL;
+    }
+
+  (void)madvise(map, (size_t)size, MADV_SEQUENTIAL);
+  return (unsigned char *)map;
+#else  /* if defined( SIXPACK_MMAP ) */
+  (void)f;
+  (void)size;
+  return NULL;
+#endif /* if defined( SIXPACK_MMAP ) */
+}
+
+/*
+ * Close the output file, after its writer if any. A mapped file is cut to
+ * the placed bytes, i.e. to what an aborted extraction would have written.
+ */
+
+static void
+unpack_close_output(FILE **f, sixpack_io **out, unsigned char **map,
+                    sixpack_off size, sixpack_off placed)
+{
+  if (*out && sixpack_io_close(*out) < 0)
+    {
+      printf("\nError: writing the file failed.\n");
+    }
+
+  *out = 0;
+
+#if defined( SIXPACK_MMAP )
+  if (*map)
+    {
+      munmap(*map, (size_t)size);
+      if (placed < size)
+        {
+          (void)ftruncate(fileno(*f), (off_t)placed);
+        }
+    }
+#else  /* if defined( SIXPACK_MMAP ) */
+  (void)size;
+  (void)placed;
+#endif /* if defined( SIXPACK_MMAP ) */
+
+  if (*f && *f != unpack_stdout)
+    {
+      fclose(*f);
+    }
+
+  *f    = 0;
+  *map  = 0;
+}
+
+/*
+ * Create the file name for writing, with the directories in its name.
+ * Names that would write outside of the current directory, absolute ones
+ * or those with a .. component, are refused. Returns NULL on failure.
+ */
+
+static FILE *
+unpack_create(char *name)
+{
+  char *  p;
+  char *  component = name;
+
+  for (p = name;; p++)
+    {
+      if (*p == '/' || *p == '\\' || *p == 0)
+        {
+          if (( p == name && *p ) || ( p - component == 2
+                                       && !strncmp(component, "..", 2) ))
+            {
+              return NULL;
+            }
+
+          component = p + 1;
+        }
+
+      if (*p == 0)
+        {
+          break;
+        }
+    }
+
+  /* Directories may exist already */
+  for (p = name; *p; p++)
+    {
+      if (*p == '/' || *p == '\\')
+        {
+          char separator = *p;
+
+          *p = 0;
+          unpack_mkdir(name);
+          *p = separator;
+        }
+    }
+
+  return fopen(name, "wb");
+}
+
+#if defined( SIXPACK_THREADS )
+
+/*
+ * Parallel decompression: this thread reads the chunks of a file into a
+ * ring of slots and hands the compressed ones to the workers of a
+ * fastlz_pool, which also verify their checksum. A writer thread takes the
+ * slots back in order and writes the output file, unless the chunks are
+ * decompressed into its mapping. The ring bounds the number of chunks in
+ * flight. When a chunk fails, the writer skips the rest of the file, which
+ * is closed once the pipeline is drained.
+ */
+
+typedef struct unpack_slot
+{
+  fastlz_job     job;
+  int            options;
+  unsigned long  size;
+  unsigned long  extra;
+  unsigned long  expected;
+  unsigned long  checksum;
+  int            mapped;
+  unsigned char  *input;
+  unsigned long  input_size;
+  unsigned char  *output;
+  unsigned long  output_size;
+} unpack_slot;
+
+typedef struct unpack_pipeline
+{
+  fastlz_pool *    pool;
+  unpack_slot *    slots;
+  unsigned long    count;
+  unsigned long    submitted;
+  unsigned long    written;
+  int              stop;
+  int              failed;
+  sixpack_off      placed;
+  sixpack_io *     out;
+  pthread_t        writer;
+  pthread_mutex_t  lock;
+  pthread_cond_t   cond;
+} unpack_pipeline;
+
+static void
+unpack_block_done(fastlz_job *job)
+{
+  unpack_slot *slot = (unpack_slot *)job->user;
+
+  slot->checksum = update_adler32(1L, slot->input, job->length);
+}
+
+/* Returns 0 if the chunk is bad */
+static int
+unpack_write_slot(unpack_pipeline *pipe, unpack_slot *slot, int failed)
+{
+  int result = 0;
+
+  if (slot->options == 1)
+    {
+      result = fastlz_pool_wait(pipe->pool, &slot->job);
+    }
+
+  if (failed)
+    {
+      return 1;
+    }
+
+  if (slot->checksum != slot->expected)
+    {
+      printf("\nError: checksum mismatch. %s\n",
+             slot->options == 1 ? "Skipped." : "Aborted.");
+      printf("Got %08lX Expecting %08lX\n", slot->checksum, slot->expected);
+      return 0;
+    }
+
+  if (slot->options == 1)
+    {
+      if (result < 0 || (unsigned long)result != slot->extra)
+        {
+          printf("\nError: decompression failed. Skipped.\n");
+          return 0;
+        }
+
+      if (!slot->mapped)
+        {
+          sixpack_io_write(pipe->out, slot->output, slot->extra);
+        }
+
+      pipe->placed += slot->extra;
+    }
+  else
+    {
+      if (!slot->mapped)
+        {
+          sixpack_io_write(pipe->out, slot->input, slot->size);
+        }
+
+      pipe->placed += slot->size;
+    }
+
+  return 1;
+}
+
+static void *
+unpack_writer(void *arg)
+{
+  unpack_pipeline * pipe  = (unpack_pipeline *)arg;
+
+  for (;;)
+    {
+      unpack_slot * slot;
+      int           failed;
+
+      pthread_mutex_lock(&pipe->lock);
+      while (pipe->written == pipe->submitted && !pipe->stop)
+        {
+          pthread_cond_wait(&pipe->cond, &pipe->lock);
+        }
+
+      if (pipe->written == pipe->submitted)
+        {
+          pthread_mutex_unlock(&pipe->lock);
+          break;
+        }
+
+      slot    = &pipe->slots[pipe->written % pipe->count];
+      failed  = pipe->failed;
+      pthread_mutex_unlock(&pipe->lock);
+
+      if (!unpack_write_slot(pipe, slot, failed))
+        {
+          failed = 1;
+        }
+
+      pthread_mutex_lock(&pipe->lock);
+      pipe->failed = failed;
+      pipe->written++;
+      pthread_cond_broadcast(&pipe->cond);
+      pthread_mutex_unlock(&pipe->lock);
+    }
+
+  return NULL;
+}
+
+static void unpack_pipeline_destroy(unpack_pipeline *pipe);
+
+static unpack_pipeline *
+unpack_pipeline_create(int threads)
+{
+  unpack_pipeline *pipe
+    = (unpack_pipeline *)calloc(1, sizeof(unpack_pipeline));
+
+  if (!pipe)
+    {
+      return NULL;
+    }
+
+  pthread_mutex_init(&pipe->lock, NULL);
+  pthread_cond_init(&pipe->cond, NULL);
+  pipe->count  = 2 * threads + 2;
+  pipe->pool   = fastlz_pool_create(threads);
+  pipe->slots  = (unpack_slot *)calloc(pipe->count, sizeof(unpack_slot));
+  if (!pipe->pool || !pipe->slots
+      || pthread_create(&pipe->writer, NULL, unpack_writer, pipe) != 0)
+    {
+      pipe->stop = -1;
+      unpack_pipeline_destroy(pipe);
+      return NULL;
+    }
+
+  return pipe;
+}
+
+/*
+ * Wait until every chunk is written, and start over for the next file.
+ * *placed is the size written, up to the first failed chunk if any.
+ */
+
+static void
+unpack_pipeline_drain(unpack_pipeline *pipe, sixpack_off *placed)
+{
+  pthread_mutex_lock(&pipe->lock);
+  while (pipe->written != pipe->submitted)
+    {
+      pthread_cond_wait(&pipe->cond, &pipe->lock);
+    }
+
+  *placed       = pipe->placed;
+  pipe->failed  = 0;
+  pipe->placed  = 0;
+  pthread_mutex_unlock(&pipe->lock);
+}
+
+static void
+unpack_pipeline_destroy(unpack_pipeline *pipe)
+{
+  unsigned long c;
+
+  if (pipe->stop == 0)
+    {
+      pthread_mutex_lock(&pipe->lock);
+      pipe->stop = 1;
+      pthread_cond_broadcast(&pipe->cond);
+      pthread_mutex_unlock(&pipe->lock);
+      pthread_join(pipe->writer, NULL);
+    }
+
+  if (pipe->pool)
+    {
+      fastlz_pool_destroy(pipe->pool);
+    }
+
+  for (c = 0; pipe->slots && c < pipe->count; c++)
+    {
+      FREE(pipe->slots[c].input);
+      FREE(pipe->slots[c].output);
+    }
+
+  FREE(pipe->slots);
+  pthread_cond_destroy(&pipe->cond);
+  pthread_mutex_destroy(&pipe->lock);
+  free(pipe);
 }
 
+/*
+ * Read the payload of a chunk 17 of the current file and queue it, to be
+ * written to out or placed at target in the mapping of the file. Stored
+ * chunks are checked here, compressed ones by a worker.
+ */
+
+static void
+unpack_pipeline_submit(unpack_pipeline *pipe, unpack_reader *in,
+                       sixpack_io *out,
+                       unsigned char *target, int options, unsigned long size,
+                       unsigned long checksum, unsigned long extra)
+{
+  unpack_slot * slot;
+  int           failed;
+
+  pthread_mutex_lock(&pipe->lock);
+  while (pipe->submitted - pipe->written >= pipe->count)
+    {
+      pthread_cond_wait(&pipe->cond, &pipe->lock);
+    }
+
+  failed = pipe->failed;
+  pthread_mutex_unlock(&pipe->lock);
+
+  /* Rest of the file is skipped anyway */
+  if (failed)
+    {
+      return;
+    }
+
+  slot = &pipe->slots[pipe->submitted % pipe->count];
+
+  /* Enlarge buffers if necessary */
+  if (size > slot->input_size && !( target && options == 0 ))
+    {
+      FREE(slot->input);
+      slot->input       = (unsigned char *)malloc(size);
+      slot->input_size  = size;
+    }
+
+  if (options == 1 && extra > slot->output_size && !target)
+    {
+      FREE(slot->output);
+      slot->output       = (unsigned char *)malloc(extra);
+      slot->output_size  = extra;
+    }
+
+  if (( !slot->input && !( target && options == 0 ))
+      || ( options == 1 && !slot->output && !target ))
+    {
+      printf("Out of memory. Aborting!\n");
+      abort();
+    }
+
+  pipe->out       = out;
+  slot->options   = options;
+  slot->mapped    = target != NULL;
+  slot->size      = unpack_read(in,
+                                target && options == 0 ? target : slot->input,
+                                size);
+  slot->extra     = extra;
+  slot->expected  = checksum;
+  if (options == 1)
+    {
+      slot->job.op        = FASTLZ_JOB_DECOMPRESS;
+      slot->job.input     = slot->input;
+      slot->job.length    = (int)slot->size;
+      slot->job.output    = target ? target : slot->output;
+      slot->job.maxout    = (int)extra;
+      slot->job.callback  = unpack_block_done;
+      slot->job.user      = slot;
+      fastlz_pool_submit(pipe->pool, &slot->job);
+    }
+  else
+    {
+      slot->checksum = update_adler32(1L, target ? target : slot->input,
+                                      slot->size);
+    }
+
+  pthread_mutex_lock(&pipe->lock);
+  pipe->submitted++;
+  pthread_cond_broadcast(&pipe->cond);
+  pthread_mutex_unlock(&pipe->lock);
+}
+
+#endif /* if defined( SIXPACK_THREADS ) */
+
+/*
+ * Extract the files of the archive, or with member, only the file of that
+ * name, found through the central directory of the archive.
+ */
+
 int
-unpack_file(const char *input_file)
+unpack_file(const char *input_file, const char *member, int threads)
 {
   FILE *          in;
-  unsigned long   fsize;
+  sixpack_off     fsize;
   int             c;
   unsigned long   percent;
   unsigned char   progress[20];
@@ -203,99 +803,231 @@ unpack_file(const char *input_file)
   unsigned long   chunk_size;
   unsigned long   chunk_checksum;
   unsigned long   chunk_extra;
-  unsigned char   buffer[BLOCK_SIZE];
+  unsigned char   buffer[ENTRY_SIZE_MAX];
   unsigned long   checksum;
 
-  unsigned long   decompressed_size;
-  unsigned long   total_extracted;
+  sixpack_off     decompressed_size;
+  sixpack_off     total_extracted;
   int             name_length;
   char *          output_file;
   FILE *          f;
-
+  sixpack_io *    out;
+  unsigned char * map;
+  sixpack_off     placed;
+  unpack_reader   reader;
+  int             streamed;
+  int             size_known;
+  sixpack_off     start;
+  int             entries;
+
+  const unsigned char * compressed;
   unsigned char * compressed_buffer;
   unsigned char * decompressed_buffer;
   unsigned long   compressed_bufsize;
   unsigned long   decompressed_bufsize;
 
+#if defined( SIXPACK_THREADS )
+  unpack_pipeline *pipe = 0;
+#endif /* if defined( SIXPACK_THREADS ) */
+
+  /* Standard input is read once, up to its end */
+  streamed = !strcmp(input_file, "-");
+  if (streamed)
+    {
+      input_file = "stdin";
+    }
+
   /* Sanity check */
-  in = fopen(input_file, "rb");
+  in = streamed ? sixpack_io_stdin() : fopen(input_file, "rb");
   if (!in)
     {
       printf("Error: could not open %s\n", input_file);
       return -1;
     }
 
-  /* Find size of the file */
-  fseek(in, 0, SEEK_END);
-  fsize = ftell(in);
-  fseek(in, 0, SEEK_SET);
+  /* Find size of the file; pipes and the like are read as stdin is */
+  fsize = (sixpack_off)-1;
+  if (!streamed && sixpack_io_size(in, &fsize) < 0)
+    {
+      fsize     = (sixpack_off)-1;
+      streamed  = 1;
+    }
 
   /* Not a 6pack archive? */
-  if (!detect_magic(in))
+  if (streamed ? fread(buffer, 1, 8, in) < 8
+                 || memcmp(buffer, sixpack_magic, 8) != 0
+               : !detect_magic(in))
     {
       fclose(in);
       printf("Error: file %s is not a 6pack archive!\n", input_file);
       return -1;
     }
 
+  /* Position of first chunk, or of the file entry of member */
+  start = 8;
+  if (member)
+    {
+      sixpack_member *  members;
+      long              files = streamed ? -1 : sixpack_members(in, fsize,
+                                                                &members);
+
+      for (c = 0; c < files; c++)
+        {
+          if (!strcmp(members[c].name, member))
+            {
+              break;
+            }
+        }
+
+      if (c < files)
+        {
+          start = members[c].offset;
+        }
+
+      if (files >= 0)
+        {
+          FREE(members);
+        }
+
+      if (c >= files)
+        {
+          if (streamed)
+            {
+              printf("Error: -x needs an archive file, not a stream\n");
+            }
+          else
+            {
+              printf("Error: no file %s in %s%s\n", member, input_file,
+                     files < 0 ? ", or it has no directory" : "");
+            }
+
+          if (in != stdin)
+            {
+              fclose(in);
+            }
+
+          return -1;
+        }
+    }
+
+#if defined( SIXPACK_THREADS )
+  if (threads > 0)
+    {
+      pipe = unpack_pipeline_create(threads);
+      if (!pipe)
+        {
+          fclose(in);
+          printf("Error: could not start %d threads!\n", threads);
+          return -1;
+        }
+    }
+
+#else  /* if defined( SIXPACK_THREADS ) */
+  (void)threads;
+#endif /* if defined( SIXPACK_THREADS ) */
   printf("Archive: %s", input_file);
 
-  /* Position of first chunk */
-  fseek(in, 8, SEEK_SET);
+  if (!streamed)
+    {
+      sixpack_io_seek(in, start);
+    }
+
+  memset(&reader, 0, sizeof( unpack_reader ));
+  reader.io        = sixpack_io_reader(in, READ_BLOCK, SIXPACK_IO_DEPTH, 0);
+  reader.position  = start;
+  if (!reader.io)
+    {
+      printf("Out of memory. Aborting!\n");
+      abort();
+    }
 
   /* Initialize */
   output_file           = 0;
   f                     = 0;
+  out                   = 0;
+  map                   = 0;
+  placed                = 0;
   total_extracted       = 0;
   decompressed_size     = 0;
+  size_known            = 1;
   percent               = 0;
   compressed_buffer     = 0;
   decompressed_buffer   = 0;
   compressed_bufsize    = 0;
   decompressed_bufsize  = 0;
+  entries               = 0;
 
   /* Main loop */
   for (;;)
     {
       /* End of file? */
-      size_t pos = ftell(in);
+      sixpack_off pos = reader.position;
       if (pos >= fsize)
         {
           break;
         }
 
-      read_chunk_header(
-        in,
-        &chunk_id,
-        &chunk_options,
-        &chunk_size,
-        &chunk_checksum,
-        &chunk_extra);
+      if (!read_chunk_header(
+            &reader,
+            &chunk_id,
+            &chunk_options,
+            &chunk_size,
+            &chunk_checksum,
+            &chunk_extra))
+        {
+          break;
+        }
+
+      /* A single file ends with its blocks */
+      if (member && chunk_id != 17 && entries++ > 0)
+        {
+          break;
+        }
 
-      if (( chunk_id == 1 ) && ( chunk_size > 10 ) && ( chunk_size < BLOCK_SIZE ))
+      if (( chunk_id == 1 ) && ( chunk_size > 10 )
+          && ( chunk_size <= ENTRY_SIZE_MAX ))
         {
           /* Close current file, if any */
+#if defined( SIXPACK_THREADS )
+          if (pipe)
+            {
+              unpack_pipeline_drain(pipe, &placed);
+            }
+
+#endif /* if defined( SIXPACK_THREADS ) */
           printf("\n");
           if (output_file)
             FREE(output_file);
 
-          if (f)
-            {
-              fclose(f);
-            }
+          unpack_close_output(&f, &out, &map, decompressed_size, placed);
 
           /* File entry */
-          fread(buffer, 1, chunk_size, in);
+          unpack_read(&reader, buffer, chunk_size);
           checksum = update_adler32(1L, buffer, chunk_size);
           if (checksum != chunk_checksum)
             {
-              fclose(in);
+              sixpack_io_close(reader.io);
+              if (in != stdin)
+                {
+                  fclose(in);
+                }
+
               printf("\nError: checksum mismatch!\n");
               printf("Got %08lX Expecting %08lX\n", checksum, chunk_checksum);
               return -1;
             }
 
-          decompressed_size  = readU32(buffer);
+          decompressed_size  = (sixpack_off)readU32(buffer + 4) << 32;
+          decompressed_size |= readU32(buffer);
+          size_known         = 0;
+          for (c = 0; c < 8; c++)
+            {
+              if (buffer[c] != SIXPACK_SIZE_UNKNOWN)
+                {
+                  size_known = 1;
+                }
+            }
+
           total_extracted    = 0;
           percent            = 0;
 
@@ -320,7 +1052,7 @@ unpack_file(const char *input_file)
             }
 
           /* Check if already exists */
-          f = fopen(output_file, "rb");
+          f = unpack_stdout ? NULL : fopen(output_file, "rb");
           if (f)
             {
               fclose(f);
@@ -331,7 +1063,7 @@ unpack_file(const char *input_file)
           else
             {
               /* Create the file */
-              f = fopen(output_file, "wb");
+              f = unpack_stdout ? unpack_stdout : unpack_create(output_file);
               if (!f)
                 {
                   printf("Can't create file %s. Skipped.\n", output_file);
@@ -339,6 +1071,21 @@ unpack_file(const char *input_file)
                 }
               else
                 {
+                  map     = unpack_stdout || !size_known
+                              ? NULL
+                              : unpack_map_output(f, decompressed_size);
+                  placed  = 0;
+                  if (!map)
+                    {
+                      out = sixpack_io_writer(f, SIXPACK_IO_WRITE_BLOCK,
+                                              SIXPACK_IO_DEPTH, 0);
+                      if (!out)
+                        {
+                          printf("Out of memory. Aborting!\n");
+                          abort();
+                        }
+                    }
+
                   /* For progress status */
                   printf("\n");
                   memset(progress, ' ', 20);
@@ -377,8 +1124,36 @@ unpack_file(const char *input_file)
 
       if (( chunk_id == 17 ) && f && output_file && decompressed_size)
         {
-          unsigned long remaining;
+          unsigned long   remaining;
+          size_t          fetched;
+          sixpack_off     length  = chunk_options == 1 ? chunk_extra
+                                                       : chunk_size;
+          unsigned char * target  = map ? map + total_extracted : NULL;
+
+          /* The mapping only holds the size given by the file entry */
+          if (map && length > decompressed_size - total_extracted)
+            {
+#if defined( SIXPACK_THREADS )
+              if (pipe)
+                {
+                  unpack_pipeline_drain(pipe, &placed);
+                }
 
+#endif /* if defined( SIXPACK_THREADS ) */
+              unpack_close_output(&f, &out, &map, decompressed_size, placed);
+              FREE(output_file);
+              printf("\nError: chunk beyond the file size. Skipped.\n");
+            }
+          else
+#if defined( SIXPACK_THREADS )
+          if (pipe && ( chunk_options == 0 || chunk_options == 1 ))
+            {
+              unpack_pipeline_submit(pipe, &reader, out, target, chunk_options,
+                                     chunk_size, chunk_checksum, chunk_extra);
+              total_extracted += length;
+            }
+          else
+#endif /* if defined( SIXPACK_THREADS ) */
           /* Uncompressed */
           switch (chunk_options)
             {
@@ -388,17 +1163,24 @@ unpack_file(const char *input_file)
               total_extracted  += chunk_size;
               remaining        = chunk_size;
               checksum         = 1L;
-              for (;;)
+              if (target)
+                {
+                  remaining  = unpack_read(&reader, target, chunk_size);
+                  checksum   = update_adler32(1L, target, remaining);
+                }
+
+              for (; !target;)
                 {
                   unsigned long  r
-                    = ( BLOCK_SIZE < remaining ) ? BLOCK_SIZE : remaining;
-                  size_t         bytes_read = fread(buffer, 1, r, in);
+                    = ( sizeof( buffer ) < remaining ) ? sizeof( buffer )
+                                                       : remaining;
+                  size_t         bytes_read = unpack_read(&reader, buffer, r);
                   if (bytes_read == 0)
                     {
                       break;
                     }
 
-                  fwrite(buffer, 1, bytes_read, f);
+                  sixpack_io_write(out, buffer, bytes_read);
                   checksum   = update_adler32(checksum, buffer, bytes_read);
                   remaining  -= bytes_read;
                 }
@@ -406,8 +1188,8 @@ unpack_file(const char *input_file)
               /* Verify everything is written correctly */
               if (checksum != chunk_checksum)
                 {
-                  fclose(f);
-                  f = 0;
+                  unpack_close_output(&f, &out, &map, decompressed_size,
+                                      placed);
                   FREE(output_file);
                   printf("\nError: checksum mismatch. Aborted.\n");
                   printf(
@@ -415,6 +1197,10 @@ unpack_file(const char *input_file)
                     checksum,
                     chunk_checksum);
                 }
+              else
+                {
+                  placed += chunk_size;
+                }
 
               break;
 
@@ -431,7 +1217,7 @@ unpack_file(const char *input_file)
                 }
 
               /* Enlarge output buffer if necessary */
-              if (chunk_extra > decompressed_bufsize)
+              if (chunk_extra > decompressed_bufsize && !target)
                 {
                   decompressed_bufsize = chunk_extra;
                   if (decompressed_buffer)
@@ -447,16 +1233,17 @@ unpack_file(const char *input_file)
                   abort();
                 }
 
-              /* Read and check checksum */
-              fread(compressed_buffer, 1, chunk_size, in);
-              checksum         = update_adler32(1L, compressed_buffer, chunk_size);
+              /* Read, in place when possible, and check checksum */
+              compressed = unpack_fetch(&reader, chunk_size,
+                                        compressed_buffer, &fetched);
+              checksum         = update_adler32(1L, compressed, chunk_size);
               total_extracted  += chunk_extra;
 
               /* Verify that the chunk data is correct */
               if (checksum != chunk_checksum)
                 {
-                  fclose(f);
-                  f = 0;
+                  unpack_close_output(&f, &out, &map, decompressed_size,
+                                      placed);
                   FREE(output_file);
                   printf("\nError: checksum mismatch. Skipped.\n");
                   printf(
@@ -469,17 +1256,21 @@ unpack_file(const char *input_file)
                   /* Decompress and verify */
                   remaining
                     = fastlz_decompress(
-                        compressed_buffer,
+                        compressed,
                         chunk_size,
-                        decompressed_buffer,
+                        target ? target : decompressed_buffer,
                         chunk_extra);
                   if (remaining != chunk_extra)
                     {
-                      fclose(f);
-                      f = 0;
+                      unpack_close_output(&f, &out, &map, decompressed_size,
+                                      placed);
                       FREE(output_file);
                       printf("\nError: decompression failed. Skipped.\n");
                     }
+                  else if (target)
+                    {
+                      placed += chunk_extra;
+                    }
                   else
                     {
                       /* Check compressed_buffer */
@@ -488,24 +1279,31 @@ unpack_file(const char *input_file)
                           printf("\nError: No decompressed buffer! Aborting!\n");
                           abort();
                         }
-                      fwrite(decompressed_buffer, 1, chunk_extra, f);
+                      sixpack_io_write(out, decompressed_buffer, chunk_extra);
+                      placed += chunk_extra;
                     }
                 }
 
               break;
 
             default:
+#if defined( SIXPACK_THREADS )
+              if (pipe)
+                {
+                  unpack_pipeline_drain(pipe, &placed);
+                }
+
+#endif /* if defined( SIXPACK_THREADS ) */
               printf(
                 "\nError: unknown compression method (%d)\n",
                 chunk_options);
-              fclose(f);
-              f = 0;
+              unpack_close_output(&f, &out, &map, decompressed_size, placed);
               FREE(output_file);
               break;
             }
 
           /* For progress, if everything is fine */
-          if (f)
+          if (f && size_known)
             {
               int last_percent = (int)percent;
               if (decompressed_size < ( 1 << 24 ))
@@ -528,9 +1326,17 @@ unpack_file(const char *input_file)
         }
 
       /* Position of next chunk */
-      fseek(in, pos + 16 + chunk_size, SEEK_SET);
+      unpack_skip_to(&reader, pos + 16 + chunk_size);
     }
 
+#if defined( SIXPACK_THREADS )
+  if (pipe)
+    {
+      unpack_pipeline_drain(pipe, &placed);
+      unpack_pipeline_destroy(pipe);
+    }
+
+#endif /* if defined( SIXPACK_THREADS ) */
   printf("\n\n");
 
   /* Free allocated stuff */
@@ -539,22 +1345,169 @@ unpack_file(const char *input_file)
   FREE(output_file);
 
   /* Close working files */
-  if (f)
+  unpack_close_output(&f, &out, &map, decompressed_size, placed);
+  sixpack_io_close(reader.io);
+  if (in != stdin)
     {
-      fclose(f);
+      fclose(in);
     }
 
-  fclose(in);
-
   /* So far so good */
   return 0;
 }
 
+/* Print the size and name of each file, from the central directory */
+int
+unpack_list(const char *archive_file)
+{
+  FILE *            in;
+  sixpack_member *  members;
+  sixpack_off       archive_size;
+  long              files;
+  long              i;
+  int               streamed = !strcmp(archive_file, "-");
+
+  /* Standard input works if it is a file, i.e. it can be seeked */
+  in = streamed ? sixpack_io_stdin() : fopen(archive_file, "rb");
+  if (!in)
+    {
+      printf("Error: could not open %s\n", archive_file);
+      return -1;
+    }
+
+  if (sixpack_io_size(in, &archive_size) < 0)
+    {
+      if (streamed)
+        {
+          printf("Error: -l needs an archive file, not a stream\n");
+        }
+      else
+        {
+          printf("Error: %s is not a 6pack archive with a directory\n",
+                 archive_file);
+          fclose(in);
+        }
+
+      return -1;
+    }
+
+  files = sixpack_members(in, archive_size, &members);
+  if (!streamed)
+    {
+      fclose(in);
+    }
+
+  if (files < 0)
+    {
+      printf("Error: %s is not a 6pack archive with a directory\n",
+             archive_file);
+      return -1;
+    }
+
+  for (i = 0; i < files; i++)
+    {
+      char size[SIXPACK_OFF_DIGITS];
+
+      printf("%12s  %s\n", sixpack_io_number(members[i].size, size),
+             members[i].name);
+    }
+
+  FREE(members);
+  return 0;
+}
+
+/*
+ * Write length bytes of the first file of a seekable archive, or of the
+ * file called member, from offset, to standard output; only the blocks
+ * holding them are decompressed, with read-ahead on the given number of
+ * threads.
+ */
+
+int
+unpack_range(const char *archive_file, const char *member,
+             sixpack_off offset, sixpack_off length, int threads)
+{
+  sixpack *       pack;
+  FILE *          out;
+  unsigned char * buffer;
+  long            bytes_read;
+  int             result = 0;
+
+  pack = sixpack_open_file(archive_file, member, 0);
+  if (!pack)
+    {
+      printf("Error: %s is not a 6pack archive with a block index\n",
+             archive_file);
+      if (member)
+        {
+          printf("or has no file %s\n", member);
+        }
+
+      return -1;
+    }
+
+  if (threads > 0)
+    {
+      sixpack_readahead(pack, threads, 0);
+    }
+
+  buffer  = (unsigned char *)malloc(READ_BLOCK);
+  out     = buffer ? sixpack_io_stdout() : NULL;
+  if (!out)
+    {
+      printf("Error: could not write to standard output\n");
+      sixpack_close(pack);
+      FREE(buffer);
+      return -1;
+    }
+
+  while (length > 0)
+    {
+      bytes_read = sixpack_pread(pack, buffer,
+                                 length < READ_BLOCK ? (size_t)length
+                                                     : READ_BLOCK,
+                                 offset);
+      if (bytes_read < 0)
+        {
+          printf("Error: damaged chunk in %s\n", archive_file);
+          result = -1;
+          break;
+        }
+
+      if (bytes_read == 0)
+        {
+          break;
+        }
+
+      fwrite(buffer, 1, bytes_read, out);
+      offset  += bytes_read;
+      length  -= bytes_read;
+    }
+
+  if (fclose(out) != 0)
+    {
+      printf("Error: writing to standard output failed\n");
+      result = -1;
+    }
+
+  sixpack_close(pack);
+  FREE(buffer);
+  return result;
+}
+
 int
 main(int argc, char **argv)
 {
   int          i;
+  int          threads;
+  int          to_stdout;
+  int          result;
+  int          range;
+  int          list;
+  sixpack_off  offset;
+  sixpack_off  length;
   const char * archive_file;
+  const char * member;
 
   /* Show help with no argument at all */
   if (argc == 1)
@@ -595,14 +1548,130 @@ main(int argc, char **argv)
         }
     }
 
-  /* Needs at least two arguments */
-  if (argc <= 1)
+  /* Sequential unless -T is given */
+  threads       = 0;
+  to_stdout     = 0;
+  range         = 0;
+  list          = 0;
+  offset        = 0;
+  length        = 0;
+  archive_file  = 0;
+  member        = 0;
+  for (i = 1; i < argc; i++)
+    {
+      /* Number of decompression threads, as -T N or -TN */
+      if (!strncmp(argv[i], "-T", 2))
+        {
+          const char *  count  = argv[i][2] ? argv[i] + 2 : argv[++i];
+#if defined( SIXPACK_THREADS )
+          char *        end    = NULL;
+          long          n      = count ? strtol(count, &end, 10) : 0;
+
+          /* A number and nothing else, e.g. not 4x */
+          if (end && end != count && *end == 0 && n >= 1
+              && n <= FASTLZ_POOL_MAX_THREADS)
+            {
+              threads = (int)n;
+              continue;
+            }
+
+          printf("Error: -T needs a thread count from 1 to %d\n\n",
+                 FASTLZ_POOL_MAX_THREADS);
+#else  /* if defined( SIXPACK_THREADS ) */
+          (void)count;
+          printf("Error: -T is not supported by this build\n\n");
+#endif /* if defined( SIXPACK_THREADS ) */
+          return -1;
+        }
+
+      /* Files in the archive */
+      if (!strcmp(argv[i], "-l"))
+        {
+          list = 1;
+          continue;
+        }
+
+      /* A single file, as -x NAME */
+      if (!strcmp(argv[i], "-x"))
+        {
+          member = argv[++i];
+          if (member)
+            {
+              continue;
+            }
+
+          printf("Error: -x needs a file name\n\n");
+          return -1;
+        }
+
+      /* Range of the first file, as -r OFFSET,LENGTH */
+      if (!strcmp(argv[i], "-r"))
+        {
+          const char *  spec  = argv[++i];
+          char *        end   = NULL;
+
+          if (spec)
+            {
+              offset = sixpack_io_parse(spec, &end);
+            }
+
+          if (end && *end == ',')
+            {
+              length = sixpack_io_parse(end + 1, &end);
+              if (*end == 0)
+                {
+                  range = 1;
+                  continue;
+                }
+            }
+
+          printf("Error: -r needs OFFSET,LENGTH\n\n");
+          return -1;
+        }
+
+      if (!archive_file)
+        {
+          archive_file = argv[i];
+        }
+      else if (!strcmp(argv[i], "-"))
+        {
+          to_stdout = 1;
+        }
+    }
+
+  /* Needs an archive */
+  if (!archive_file)
     {
       usage();
       return 0;
     }
 
-  archive_file = argv[1];
+  if (list)
+    {
+      return unpack_list(archive_file);
+    }
+
+  if (range)
+    {
+      return unpack_range(archive_file, member, offset, length, threads);
+    }
+
+  if (to_stdout)
+    {
+      unpack_stdout = sixpack_io_stdout();
+      if (!unpack_stdout)
+        {
+          printf("Error: could not write to standard output\n");
+          return -1;
+        }
+    }
+
+  result = unpack_file(archive_file, member, threads);
+  if (unpack_stdout && fclose(unpack_stdout) != 0)
+    {
+      printf("Error: writing to standard output failed\n");
+      result = -1;
+    }
 
-  return unpack_file(archive_file);
+  return result;
 }
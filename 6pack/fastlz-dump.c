@@ -0,0 +1,586 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * FASTLZ-DUMP - show the literal/match structure of FastLZ blocks
+ *
+ * Copyright (c) 2007-2020 Ariya Hidayat <ariya.hidayat@gmail.com>
+ * Copyright (c) 2023 Jeffrey H. Johnson <trnsz@pobox.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ *  * The above copyright notice and this permission notice shall be
+ *    included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FASTLZ_DUMP_VERSION_STRING  "0.1.0"
+
+#include "fastlz.h"
+
+/* Magic identifier for 6pack file */
+static unsigned char sixpack_magic[8] = {
+  137, '6', 'P', 'K', 13, 10, 26, 10
+};
+
+/* Same limits as fastlz.c */
+#define MAX_COPY          32
+#define MAX_L2_DISTANCE   8191
+
+/* Power of two buckets: 1, 2-3, 4-7, ... */
+#define BUCKETS           32
+
+/* Sequences parsed per call */
+#define SEQ_BATCH         1024
+
+typedef struct dump_stats
+{
+  unsigned long  blocks[3];       /* by level, 0 = stored */
+  unsigned long  stored_bytes;
+  unsigned long  compressed;
+  unsigned long  decompressed;
+  unsigned long  literal_runs;    /* runs between two matches */
+  unsigned long  literal_bytes;
+  unsigned long  literal_codes;   /* one opcode byte per 32 literals */
+  unsigned long  matches;
+  unsigned long  match_bytes;
+  unsigned long  match_codes;     /* bytes of match instructions */
+  unsigned long  far_matches;
+  unsigned long  far_bytes;
+  unsigned long  level2_matches;
+  unsigned long  match_length[BUCKETS];
+  unsigned long  distance[BUCKETS];
+  unsigned long  literal_run[BUCKETS];
+} dump_stats;
+
+/* Prototypes */
+void usage(void);
+static unsigned long readU16(const unsigned char *ptr);
+static unsigned long readU32(const unsigned char *ptr);
+static const char *size_text(const unsigned char *ptr, char *text);
+static int bucket(unsigned long value);
+static unsigned long match_code_size(int level, const fastlz_sequence *s);
+int dump_block(dump_stats *stats, const unsigned char *block, int length);
+int dump_archive(dump_stats *stats, const char *input_file);
+int dump_raw(dump_stats *stats, const char *input_file);
+static double percent(unsigned long part, unsigned long total);
+void print_histogram(const char *title, const unsigned long *counts);
+void print_stats(const dump_stats *stats);
+
+void
+usage(void)
+{
+  printf("fastlz-dump: show the structure of FastLZ compressed data\n");
+  printf("Copyright (C) Ariya Hidayat\n");
+  printf("\n");
+  printf("Usage: fastlz-dump [options]  file  [file ...]\n");
+  printf("\n");
+  printf("Options:\n");
+  printf("  -r    files are raw compressed blocks, not 6pack archives\n");
+  printf("  -v    show program version\n");
+  printf("\n");
+}
+
+static unsigned long
+readU16(const unsigned char *ptr)
+{
+  return ptr[0] + ( ptr[1] << 8 );
+}
+
+static unsigned long
+readU32(const unsigned char *ptr)
+{
+  return ptr[0] + ( ptr[1] << 8 ) + ( ptr[2] << 16 )
+         + ((unsigned long)ptr[3] << 24 );
+}
+
+/*
+ * The 64-bit size of a file entry in bytes, or "unknown size" for a file
+ * packed from a stream; text holds at least 32 bytes. C90 printf has no
+ * conversion for 64-bit integers.
+ */
+
+static const char *
+size_text(const unsigned char *ptr, char *text)
+{
+  uint64_t  size  = ( (uint64_t)readU32(ptr + 4) << 32 ) | readU32(ptr);
+  char      digits[21];
+  int       c     = sizeof( digits ) - 1;
+
+  if (size == (uint64_t)-1)
+    {
+      return "unknown size";
+    }
+
+  digits[c] = 0;
+  do
+    {
+      digits[--c]  = '0' + (char)( size % 10 );
+      size        /= 10;
+    }
+  while (size > 0);
+
+  strcpy(text, digits + c);
+  strcat(text, " bytes");
+  return text;
+}
+
+static int
+bucket(unsigned long value)
+{
+  int b = 0;
+
+  while (value > 1 && b < BUCKETS - 1)
+    {
+      value >>= 1;
+      b++;
+    }
+
+  return b;
+}
+
+/* Encoded size of the match instruction of a sequence */
+static unsigned long
+match_code_size(int level, const fastlz_sequence *s)
+{
+  unsigned long size = s->match_length < 9 ? 2 : 3;
+
+  if (level == 2)
+    {
+      if (s->match_length >= 9)
+        {
+          size += ( s->match_length - 9 ) / 255;
+        }
+
+      if (s->distance > MAX_L2_DISTANCE)
+        {
+          size += 2;
+        }
+    }
+
+  return size;
+}
+
+int
+dump_block(dump_stats *stats, const unsigned char *block, int length)
+{
+  fastlz_parser    parser;
+  fastlz_sequence  seq[SEQ_BATCH];
+  unsigned long    run;
+  int              count, i;
+
+  memset(&parser, 0, sizeof( parser ));
+  run = 0;
+  while (( count = fastlz_parse(&parser, block, length, seq, SEQ_BATCH)) > 0)
+    {
+      for (i = 0; i < count; i++)
+        {
+          const fastlz_sequence *s = &seq[i];
+
+          if (s->literal_length > 0)
+            {
+              run                   += s->literal_length;
+              stats->literal_bytes  += s->literal_length;
+              stats->literal_codes++;
+            }
+
+          if (s->match_length == 0)
+            {
+              continue;
+            }
+
+          /* Consecutive literal instructions count as one run */
+          if (run > 0)
+            {
+              stats->literal_runs++;
+              stats->literal_run[bucket(run)]++;
+              run = 0;
+            }
+
+          stats->matches++;
+          stats->match_bytes  += s->match_length;
+          stats->match_codes  += match_code_size(parser.level, s);
+          stats->match_length[bucket(s->match_length)]++;
+          stats->distance[bucket(s->distance)]++;
+          if (parser.level == 2)
+            {
+              stats->level2_matches++;
+              if (s->distance > MAX_L2_DISTANCE)
+                {
+                  stats->far_matches++;
+                  stats->far_bytes += s->match_length;
+                }
+            }
+        }
+    }
+
+  if (count < 0)
+    {
+      return count;
+    }
+
+  if (run > 0)
+    {
+      stats->literal_runs++;
+      stats->literal_run[bucket(run)]++;
+    }
+
+  stats->blocks[parser.level]++;
+  stats->compressed    += length;
+  stats->decompressed  += parser.output;
+
+  return 0;
+}
+
+int
+dump_archive(dump_stats *stats, const char *input_file)
+{
+  FILE *           in;
+  unsigned char    header[16];
+  unsigned char *  buffer;
+  unsigned long    bufsize;
+  int              result;
+
+  in = fopen(input_file, "rb");
+  if (!in)
+    {
+      printf("Error: could not open %s\n", input_file);
+      return -1;
+    }
+
+  if (fread(header, 1, 8, in) != 8 || memcmp(header, sixpack_magic, 8))
+    {
+      printf("Error: file %s is not a 6pack archive!\n", input_file);
+      fclose(in);
+      return -1;
+    }
+
+  printf("Archive: %s\n", input_file);
+
+  buffer   = NULL;
+  bufsize  = 0;
+  result   = 0;
+  while (fread(header, 1, 16, in) == 16)
+    {
+      int            chunk_id       = (int)readU16(header);
+      int            chunk_options  = (int)readU16(header + 2);
+      unsigned long  chunk_size     = readU32(header + 4);
+      unsigned long  chunk_extra    = readU32(header + 12);
+
+      if (chunk_size > 0x7fffffffUL)
+        {
+          printf("Error: chunk too large in %s\n", input_file);
+          result = -1;
+          break;
+        }
+
+      if (chunk_size > bufsize)
+        {
+          free(buffer);
+          bufsize  = chunk_size;
+          buffer   = (unsigned char *)malloc(bufsize);
+          if (!buffer)
+            {
+              printf("Error: not enough memory!\n");
+              result = -1;
+              break;
+            }
+        }
+
+      if (fread(buffer, 1, chunk_size, in) != chunk_size)
+        {
+          printf("Error: truncated chunk in %s\n", input_file);
+          result = -1;
+          break;
+        }
+
+      /* File entry */
+      if (chunk_id == 1 && chunk_size > 10)
+        {
+          unsigned long name_length = readU16(buffer + 8);
+          char          size[32];
+
+          if (name_length > chunk_size - 10)
+            {
+              name_length = chunk_size - 10;
+            }
+
+          printf("  %.*s (%s)\n", (int)name_length,
+                 (const char *)buffer + 10, size_text(buffer, size));
+        }
+
+      if (chunk_id != 17)
+        {
+          continue;
+        }
+
+      if (chunk_options == 0)
+        {
+          stats->blocks[0]++;
+          stats->stored_bytes  += chunk_size;
+          stats->compressed    += chunk_size;
+          stats->decompressed  += chunk_size;
+        }
+      else if (chunk_options != 1
+               || dump_block(stats, buffer, (int)chunk_size) < 0)
+        {
+          printf("Error: bad block of %lu bytes (%lu expected) in %s\n",
+                 chunk_size, chunk_extra, input_file);
+          result = -1;
+        }
+    }
+
+  free(buffer);
+  fclose(in);
+
+  return result;
+}
+
+int
+dump_raw(dump_stats *stats, const char *input_file)
+{
+  FILE *           in;
+  unsigned char *  buffer;
+  long             fsize;
+  int              result;
+
+  in = fopen(input_file, "rb");
+  if (!in)
+    {
+      printf("Error: could not open %s\n", input_file);
+      return -1;
+    }
+
+  fseek(in, 0, SEEK_END);
+  fsize = ftell(in);
+  fseek(in, 0, SEEK_SET);
+  if (fsize <= 0 || fsize > 0x7fffffffL)
+    {
+      printf("Error: bad size of %s\n", input_file);
+      fclose(in);
+      return -1;
+    }
+
+  buffer = (unsigned char *)malloc(fsize);
+  if (!buffer)
+    {
+      printf("Error: not enough memory!\n");
+      fclose(in);
+      return -1;
+    }
+
+  printf("Block: %s\n", input_file);
+  result = -1;
+  if (fread(buffer, 1, fsize, in) != (size_t)fsize)
+    {
+      printf("Error reading file %s!\n", input_file);
+    }
+  else if (dump_block(stats, buffer, (int)fsize) < 0)
+    {
+      printf("Error: %s is not a valid FastLZ block\n", input_file);
+    }
+  else
+    {
+      result = 0;
+    }
+
+  free(buffer);
+  fclose(in);
+
+  return result;
+}
+
+static double
+percent(unsigned long part, unsigned long total)
+{
+  return total ? 100. * (double)part / (double)total : 0.;
+}
+
+void
+print_histogram(const char *title, const unsigned long *counts)
+{
+  unsigned long  total, most;
+  int            b, first, last;
+
+  total  = 0;
+  most   = 0;
+  first  = -1;
+  last   = -1;
+  for (b = 0; b < BUCKETS; b++)
+    {
+      total += counts[b];
+      if (counts[b] > most)
+        {
+          most = counts[b];
+        }
+
+      if (counts[b])
+        {
+          first  = first < 0 ? b : first;
+          last   = b;
+        }
+    }
+
+  printf("\n%s\n", title);
+  if (!total)
+    {
+      printf("  (none)\n");
+      return;
+    }
+
+  for (b = first; b <= last; b++)
+    {
+      unsigned long  low   = 1UL << b;
+      unsigned long  high  = ( low << 1 ) - 1;
+      char           range[48]; /* two 64-bit numbers and a dash */
+      int            width;
+
+      if (b == 0)
+        {
+          sprintf(range, "1");
+        }
+      else
+        {
+          sprintf(range, "%lu-%lu", low, high);
+        }
+
+      width = (int)( counts[b] * 40 / most );
+      printf("  %13s %10lu %5.1f%% ", range, counts[b],
+             percent(counts[b], total));
+      while (width-- > 0)
+        {
+          printf("#");
+        }
+
+      printf("\n");
+    }
+}
+
+void
+print_stats(const dump_stats *stats)
+{
+  unsigned long codes = stats->literal_codes + stats->match_codes;
+
+  printf("\nBlocks:     %lu level 1, %lu level 2, %lu stored\n",
+         stats->blocks[1], stats->blocks[2], stats->blocks[0]);
+  printf("Size:       %lu bytes -> %lu bytes (%.1f%%)\n",
+         stats->decompressed, stats->compressed,
+         percent(stats->compressed, stats->decompressed));
+  printf("Stored:     %lu bytes in stored blocks\n", stats->stored_bytes);
+  printf("Literals:   %lu bytes in %lu runs, %lu opcode bytes "
+         "(%lu beyond one per run, from the %d byte limit)\n",
+         stats->literal_bytes, stats->literal_runs, stats->literal_codes,
+         stats->literal_codes - stats->literal_runs, MAX_COPY);
+  printf("Matches:    %lu bytes in %lu matches, %lu instruction bytes\n",
+         stats->match_bytes, stats->matches, stats->match_codes);
+  if (stats->level2_matches)
+    {
+      printf("Far:        %lu of %lu level 2 matches (%.1f%%), %lu bytes\n",
+             stats->far_matches, stats->level2_matches,
+             percent(stats->far_matches, stats->level2_matches),
+             stats->far_bytes);
+    }
+
+  printf("Opcodes:    %lu bytes (%.1f%% of compressed), "
+         "literal opcodes %.1f%%\n",
+         codes, percent(codes, stats->compressed),
+         percent(stats->literal_codes, stats->compressed));
+
+  print_histogram("Match length (bytes per instruction):",
+                  stats->match_length);
+  print_histogram("Match distance:", stats->distance);
+  print_histogram("Literal run length (between matches):",
+                  stats->literal_run);
+}
+
+int
+main(int argc, char **argv)
+{
+  dump_stats  stats;
+  int         raw;
+  int         files;
+  int         result;
+  int         i;
+
+  /* Show help with no argument at all */
+  if (argc == 1)
+    {
+      usage();
+      return 0;
+    }
+
+  memset(&stats, 0, sizeof( stats ));
+  raw     = 0;
+  files   = 0;
+  result  = 0;
+  for (i = 1; i < argc; i++)
+    {
+      const char *argument = argv[i];
+
+      if (!strcmp(argument, "-h") || !strcmp(argument, "--help"))
+        {
+          usage();
+          return 0;
+        }
+
+      if (!strcmp(argument, "-v") || !strcmp(argument, "--version"))
+        {
+          printf("fastlz-dump: show the structure of FastLZ data\n");
+          printf(
+            "Version %s (using FastLZ %s)\n",
+            FASTLZ_DUMP_VERSION_STRING,
+            FASTLZ_VERSION_STRING);
+          printf("Copyright (C) Ariya Hidayat\n");
+          printf("\n");
+          return 0;
+        }
+
+      if (!strcmp(argument, "-r"))
+        {
+          raw = 1;
+          continue;
+        }
+
+      if (argument[0] == '-')
+        {
+          printf("Error: unknown option %s\n\n", argument);
+          printf("To get help on usage:\n");
+          printf("  fastlz-dump --help\n\n");
+          return -1;
+        }
+
+      files++;
+      if (( raw ? dump_raw(&stats, argument)
+                : dump_archive(&stats, argument)) < 0)
+        {
+          result = -1;
+        }
+    }
+
+  if (!files)
+    {
+      printf("Error: input file is not specified.\n\n");
+      return -1;
+    }
+
+  print_stats(&stats);
+
+  return result;
+}
@@ -0,0 +1,825 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * 6PACK - file compressor using FastLZ (lightning-fast compression library)
+ *
+ * Copyright (c) 2007-2020 Ariya Hidayat <ariya.hidayat@gmail.com>
+ * Copyright (c) 2023 Jeffrey H. Johnson <trnsz@pobox.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ *  * The above copyright notice and this permission notice shall be
+ *    included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fastlz.h"
+#include "sixpack.h"
+#include "sixpack_io.h"
+
+/* Read-ahead on worker threads, built with -DSIXPACK_THREADS */
+#if defined( SIXPACK_THREADS )
+# include "fastlz_pool.h"
+#endif /* if defined( SIXPACK_THREADS ) */
+
+#undef FREE
+#define FREE(p) do  \
+  {                 \
+    free((p));      \
+    (p) = NULL;     \
+  } while(0)
+
+/* Magic identifier for 6pack file */
+static unsigned char sixpack_magic[8] = {
+  137, '6', 'P', 'K', 13, 10, 26, 10
+};
+
+/* Chunks at the end of the archive, as written by 6pack */
+#define SIXPACK_CHUNK_INDEX      32
+#define SIXPACK_CHUNK_FOOTER     33
+#define SIXPACK_CHUNK_DIRECTORY  34
+#define SIXPACK_INDEX_ENTRY      24
+#define SIXPACK_FOOTER_SIZE      32
+
+/* Fixed part of a directory entry, before the name */
+#define SIXPACK_MEMBER_SIZE      18
+
+/* No block in a cache slot */
+#define NO_ENTRY  ((unsigned long)-1 )
+
+typedef struct sixpack_block
+{
+  unsigned long   entry;     /* in the index, or NO_ENTRY */
+  unsigned long   used;      /* tick of the last use */
+  unsigned char * data;
+  unsigned long   length;
+  unsigned long   capacity;
+#if defined( SIXPACK_THREADS )
+  fastlz_job      job;
+  int             pending;   /* job submitted and not waited for */
+  unsigned long   expected;
+  unsigned long   checksum;
+  unsigned char * input;
+  unsigned long   input_size;
+#endif /* if defined( SIXPACK_THREADS ) */
+} sixpack_block;
+
+struct sixpack
+{
+  FILE *          f;
+  unsigned char * entries;
+  unsigned long   count;     /* entries of the file */
+  sixpack_off     size;
+  sixpack_block * cache;
+  int             cache_blocks;
+  unsigned long   tick;
+  unsigned char * compressed;
+  unsigned long   compressed_size;
+#if defined( SIXPACK_THREADS )
+  fastlz_pool *   pool;
+  unsigned long   last;      /* entry of the last read */
+  int             ahead;     /* blocks decoded ahead of it */
+  int             max_ahead;
+#endif /* if defined( SIXPACK_THREADS ) */
+};
+
+/* Adler-32 checksum algorithm; see RFC-1950, Section 8.2 */
+#define ADLER32_BASE  65521
+static unsigned long
+update_adler32(unsigned long checksum, const void *buf, int len)
+{
+  const unsigned char * ptr  = (const unsigned char *)buf;
+  unsigned long         s1   = checksum & 0xffff;
+  unsigned long         s2   = ( checksum >> 16 ) & 0xffff;
+
+  while (len > 0)
+    {
+      unsigned k = len < 5552 ? len : 5552;
+      len -= k;
+
+      while (k >= 8)
+        {
+          s1  += *ptr++;
+          s2  += s1;
+          s1  += *ptr++;
+          s2  += s1;
+          s1  += *ptr++;
+          s2  += s1;
+          s1  += *ptr++;
+          s2  += s1;
+          s1  += *ptr++;
+          s2  += s1;
+          s1  += *ptr++;
+          s2  += s1;
+          s1  += *ptr++;
+          s2  += s1;
+          s1  += *ptr++;
+          s2  += s1;
+          k   -= 8;
+        }
+
+      while (k-- > 0)
+        {
+          s1  += *ptr++;
+          s2  += s1;
+        }
+      s1  = s1 % ADLER32_BASE;
+      s2  = s2 % ADLER32_BASE;
+    }
+  return ( s2 << 16 ) + s1;
+}
+
+static unsigned long
+readU16(const unsigned char *ptr)
+{
+  return ptr[0] + ( ptr[1] << 8 );
+}
+
+static unsigned long
+readU32(const unsigned char *ptr)
+{
+  return ptr[0] + ( ptr[1] << 8 ) + ( ptr[2] << 16 )
+         + ( (unsigned long)ptr[3] << 24 );
+}
+
+static sixpack_off
+readU64(const unsigned char *ptr)
+{
+  return ((sixpack_off)readU32(ptr + 4) << 32 ) | readU32(ptr);
+}
+
+/* Read the 16-byte chunk header at position; returns 0, or -1 */
+static int
+read_header(FILE *f, sixpack_off position, unsigned char *header)
+{
+  if (sixpack_io_seek(f, position) < 0 || fread(header, 1, 16, f) != 16)
+    {
+      return -1;
+    }
+
+  return 0;
+}
+
+/* Offset in the file of the block of entry i */
+static sixpack_off
+entry_offset(const sixpack *pack, unsigned long i)
+{
+  return readU64(pack->entries + i * SIXPACK_INDEX_ENTRY + 8);
+}
+
+/* Slot holding entry i, or else the least recently used one */
+static sixpack_block *
+find_slot(sixpack *pack, unsigned long i)
+{
+  sixpack_block * block = NULL;
+  int             c;
+
+  for (c = 0; c < pack->cache_blocks; c++)
+    {
+      if (pack->cache[c].entry == i)
+        {
+          return &pack->cache[c];
+        }
+
+      if (!block || pack->cache[c].used < block->used)
+        {
+          block = &pack->cache[c];
+        }
+    }
+
+  return block;
+}
+
+/* Make room for size bytes; the old contents do not matter */
+static int
+grow(unsigned char **buffer, unsigned long *capacity, unsigned long size)
+{
+  if (size > *capacity)
+    {
+      FREE(*buffer);
+      *capacity  = 0;
+      *buffer    = (unsigned char *)malloc(size);
+      if (!*buffer)
+        {
+          return -1;
+        }
+
+      *capacity = size;
+    }
+
+  return 0;
+}
+
+#if defined( SIXPACK_THREADS )
+
+/* Checksum of a prefetched chunk, on the worker that decompressed it */
+static void
+block_done(fastlz_job *job)
+{
+  sixpack_block *block = (sixpack_block *)job->user;
+
+  block->checksum = update_adler32(1L, block->input, job->length);
+}
+
+/*
+ * Wait for the pending block. A damaged chunk is dropped from the cache,
+ * so that the read which needs it reads it again and reports it.
+ */
+
+static void
+finish_block(sixpack *pack, sixpack_block *block)
+{
+  int result = fastlz_pool_wait(pack->pool, &block->job);
+
+  block->pending = 0;
+  if (result < 0 || (unsigned long)result != block->length
+      || block->checksum != block->expected)
+    {
+      block->entry = NO_ENTRY;
+    }
+}
+
+#endif /* if defined( SIXPACK_THREADS ) */
+
+/*
+ * Read the chunk of entry i into block and decode it. With prefetch, a
+ * compressed chunk is only handed to the pool. Returns 0, or -1 if the
+ * chunk is damaged or can not be read.
+ */
+
+static int
+read_block(sixpack *pack, unsigned long i, sixpack_block *block,
+           int prefetch)
+{
+  const unsigned char * entry    = pack->entries + i * SIXPACK_INDEX_ENTRY;
+  unsigned char         header[16];
+  unsigned char *       payload;
+  sixpack_off           position;
+  unsigned long         size;
+  unsigned long         extra;
+  int                   options;
+
+  position      = readU64(entry);
+  size          = readU32(entry + 16);
+  extra         = readU32(entry + 20);
+  block->entry  = NO_ENTRY;
+  if (read_header(pack->f, position, header) < 0
+      || readU16(header) != 17 || readU32(header + 4) != size
+      || readU32(header + 12) != extra || size > INT_MAX || extra > INT_MAX
+      || grow(&block->data, &block->capacity, extra) < 0)
+    {
+      return -1;
+    }
+
+  /* Stored blocks are read in place */
+  options = (int)readU16(header + 2);
+  if (( options != 0 && options != 1 ) || ( options == 0 && size != extra ))
+    {
+      return -1;
+    }
+
+#if defined( SIXPACK_THREADS )
+  if (prefetch && options == 1)
+    {
+      if (grow(&block->input, &block->input_size, size) < 0
+          || fread(block->input, 1, size, pack->f) != size)
+        {
+          return -1;
+        }
+
+      block->job.op        = FASTLZ_JOB_DECOMPRESS;
+      block->job.input     = block->input;
+      block->job.length    = (int)size;
+      block->job.output    = block->data;
+      block->job.maxout    = (int)extra;
+      block->job.callback  = block_done;
+      block->job.user      = block;
+      block->expected      = readU32(header + 8);
+      block->pending       = 1;
+      block->entry         = i;
+      block->length        = extra;
+      fastlz_pool_submit(pack->pool, &block->job);
+      return 0;
+    }
+#else  /* if defined( SIXPACK_THREADS ) */
+  (void)prefetch;
+#endif /* if defined( SIXPACK_THREADS ) */
+
+  if (options == 1
+      && grow(&pack->compressed, &pack->compressed_size, size) < 0)
+    {
+      return -1;
+    }
+
+  payload = options == 0 ? block->data : pack->compressed;
+  if (fread(payload, 1, size, pack->f) != size
+      || update_adler32(1L, payload, (int)size) != readU32(header + 8))
+    {
+      return -1;
+    }
+
+  if (options == 1
+      && fastlz_decompress(payload, (int)size, block->data, (int)extra)
+         != (int)extra)
+    {
+      return -1;
+    }
+
+  block->entry   = i;
+  block->length  = extra;
+  return 0;
+}
+
+#if defined( SIXPACK_THREADS )
+
+/*
+ * After a read of entry i, queue the blocks that follow it if the reads
+ * are sequential. The window doubles with each block read in order, up to
+ * max_ahead, and closes on a jump; reading from the start counts as in
+ * order. Slots are only taken from blocks older than the window, and a
+ * chunk that can not be queued is left to the read that needs it.
+ */
+
+static void
+read_ahead(sixpack *pack, unsigned long i)
+{
+  unsigned long j;
+
+  if (i == pack->last)
+    {
+      return;
+    }
+
+  if (i == pack->last + 1)
+    {
+      pack->ahead = pack->ahead ? 2 * pack->ahead : 1;
+      if (pack->ahead > pack->max_ahead)
+        {
+          pack->ahead = pack->max_ahead;
+        }
+    }
+  else
+    {
+      pack->ahead = 0;
+    }
+
+  pack->last = i;
+  for (j = i + 1; j <= i + pack->ahead && j < pack->count; j++)
+    {
+      sixpack_block *block = find_slot(pack, j);
+
+      if (block->entry == j)
+        {
+          continue;
+        }
+
+      if (block->entry == i)
+        {
+          break;
+        }
+
+      if (block->pending)
+        {
+          finish_block(pack, block);
+        }
+
+      if (read_block(pack, j, block, 1) < 0)
+        {
+          break;
+        }
+
+      block->used = pack->tick;
+    }
+}
+
+#endif /* if defined( SIXPACK_THREADS ) */
+
+/* Block of entry i, decoded into the least recently used slot if needed */
+static sixpack_block *
+load_block(sixpack *pack, unsigned long i)
+{
+  sixpack_block *block = find_slot(pack, i);
+
+  pack->tick++;
+#if defined( SIXPACK_THREADS )
+  if (block->pending)
+    {
+      finish_block(pack, block);
+    }
+#endif /* if defined( SIXPACK_THREADS ) */
+
+  if (block->entry != i && read_block(pack, i, block, 0) < 0)
+    {
+      return NULL;
+    }
+
+  block->used = pack->tick;
+#if defined( SIXPACK_THREADS )
+  if (pack->pool)
+    {
+      read_ahead(pack, i);
+    }
+#endif /* if defined( SIXPACK_THREADS ) */
+
+  return block;
+}
+
+/*
+ * Check the magic and read the footer at the end of the archive: the
+ * position and number of entries of the block index, if any, and the
+ * position of the central directory chunk, or 0 without one. The index
+ * ends where the directory starts, and the directory where the footer
+ * starts. Returns 0, or -1 if the archive has no valid footer.
+ */
+
+static int
+read_footer(FILE *f, sixpack_off archive_size, sixpack_off *index,
+            unsigned long *count, sixpack_off *directory)
+{
+  unsigned char   footer[SIXPACK_FOOTER_SIZE];
+  sixpack_off     end      = archive_size - SIXPACK_FOOTER_SIZE;
+  sixpack_off     entries;
+  unsigned long   size;
+
+  if (archive_size < 8 + SIXPACK_FOOTER_SIZE
+      || read_header(f, 0, footer) < 0
+      || memcmp(footer, sixpack_magic, 8) != 0
+      || read_header(f, end, footer) < 0
+      || fread(footer + 16, 1, 16, f) != 16
+      || readU16(footer) != SIXPACK_CHUNK_FOOTER
+      || readU32(footer + 4) != 16
+      || update_adler32(1L, footer + 16, 16) != readU32(footer + 8))
+    {
+      return -1;
+    }
+
+  /* Size of the directory chunk in the extra field of the footer */
+  size        = readU32(footer + 12);
+  *directory  = 0;
+  if (size > 0)
+    {
+      if (size < 16 || size > end - 8)
+        {
+          return -1;
+        }
+
+      *directory  = end - size;
+      end         = *directory;
+    }
+
+  *index   = readU64(footer + 16);
+  entries  = readU64(footer + 24);
+  if (entries > 0
+      && ( entries > INT_MAX / SIXPACK_INDEX_ENTRY || *index > end
+           || end - *index != 16 + entries * SIXPACK_INDEX_ENTRY ))
+    {
+      return -1;
+    }
+
+  *count = (unsigned long)entries;
+  return 0;
+}
+
+long
+sixpack_members(FILE *f, sixpack_off archive_size, sixpack_member **members)
+{
+  unsigned char     header[16];
+  unsigned char *   data;
+  unsigned char *   p;
+  sixpack_off       index;
+  unsigned long     count;
+  sixpack_off       directory;
+  unsigned long     size;
+  unsigned long     files;
+  unsigned long     i;
+  sixpack_member *  list;
+
+  *members = NULL;
+  if (read_footer(f, archive_size, &index, &count, &directory) < 0
+      || directory == 0 || read_header(f, directory, header) < 0
+      || readU16(header) != SIXPACK_CHUNK_DIRECTORY)
+    {
+      return -1;
+    }
+
+  /* Each entry holds at least a terminating zero as its name */
+  size   = readU32(header + 4);
+  files  = readU32(header + 12);
+  if (size > INT_MAX || files > size / ( SIXPACK_MEMBER_SIZE + 1 ))
+    {
+      return -1;
+    }
+
+  /* The names point into the entries, kept after the array */
+  list = (sixpack_member *)malloc(files * sizeof(sixpack_member) + size + 1);
+  if (!list)
+    {
+      return -1;
+    }
+
+  data = (unsigned char *)( list + files );
+  if (fread(data, 1, size, f) != size
+      || update_adler32(1L, data, (int)size) != readU32(header + 8))
+    {
+      free(list);
+      return -1;
+    }
+
+  for (i = 0, p = data; i < files; i++)
+    {
+      unsigned long length;
+
+      if (data + size - p < SIXPACK_MEMBER_SIZE
+          || ( length = readU16(p + 16) ) == 0
+          || (unsigned long)( data + size - p ) < SIXPACK_MEMBER_SIZE + length
+          || p[SIXPACK_MEMBER_SIZE + length - 1] != 0)
+        {
+          free(list);
+          return -1;
+        }
+
+      list[i].offset  = readU64(p);
+      list[i].size    = readU64(p + 8);
+      list[i].name    = (const char *)p + SIXPACK_MEMBER_SIZE;
+      p              += SIXPACK_MEMBER_SIZE + length;
+    }
+
+  *members = list;
+  return (long)files;
+}
+
+sixpack *
+sixpack_open_file(const char *archive_file, const char *name,
+                  int cache_blocks)
+{
+  sixpack *         pack = (sixpack *)calloc(1, sizeof(sixpack));
+  sixpack_member *  members;
+  unsigned char     header[16];
+  sixpack_off       archive_size;
+  sixpack_off       index;
+  unsigned long     count;
+  sixpack_off       directory;
+  sixpack_off       start;
+  sixpack_off       end;
+  unsigned long     first;
+  sixpack_off       offset;
+  unsigned long     i;
+  long              files;
+
+  if (!pack)
+    {
+      return NULL;
+    }
+
+  /* Magic, then the footer at the very end; the index is needed */
+  pack->f = fopen(archive_file, "rb");
+  if (!pack->f || sixpack_io_size(pack->f, &archive_size) < 0
+      || read_footer(pack->f, archive_size, &index, &count, &directory) < 0
+      || count == 0)
+    {
+      sixpack_close(pack);
+      return NULL;
+    }
+
+  pack->entries = (unsigned char *)malloc(count * SIXPACK_INDEX_ENTRY + 1);
+  if (!pack->entries || read_header(pack->f, index, header) < 0
+      || readU16(header) != SIXPACK_CHUNK_INDEX
+      || readU32(header + 4) != count * SIXPACK_INDEX_ENTRY
+      || fread(pack->entries, SIXPACK_INDEX_ENTRY, count, pack->f) != count
+      || update_adler32(1L, pack->entries,
+                        (int)( count * SIXPACK_INDEX_ENTRY ))
+         != readU32(header + 8))
+    {
+      sixpack_close(pack);
+      return NULL;
+    }
+
+  /* Chunks of the file, from the directory if the archive has one */
+  start  = 0;
+  end    = index;
+  files  = sixpack_members(pack->f, archive_size, &members);
+  if (files >= 0 || name)
+    {
+      for (i = 0; files > 0 && i < (unsigned long)files; i++)
+        {
+          if (!name || !strcmp(members[i].name, name))
+            {
+              break;
+            }
+        }
+
+      if (files <= 0 || i == (unsigned long)files)
+        {
+          FREE(members);
+          sixpack_close(pack);
+          return NULL;
+        }
+
+      start  = members[i].offset;
+      end    = i + 1 < (unsigned long)files ? members[i + 1].offset : index;
+      FREE(members);
+    }
+
+  /* Its blocks follow its file entry, in the order of the file */
+  for (first = 0; first < count; first++)
+    {
+      if (readU64(pack->entries + first * SIXPACK_INDEX_ENTRY) > start)
+        {
+          break;
+        }
+    }
+
+  for (i = first, offset = 0; i < count; i++)
+    {
+      const unsigned char *entry = pack->entries + i * SIXPACK_INDEX_ENTRY;
+
+      if (readU64(entry) >= end || readU64(entry + 8) != offset)
+        {
+          break;
+        }
+
+      offset += readU32(entry + 20);
+    }
+
+  memmove(pack->entries, pack->entries + first * SIXPACK_INDEX_ENTRY,
+          ( i - first ) * SIXPACK_INDEX_ENTRY);
+  pack->count         = i - first;
+  pack->size          = offset;
+  pack->cache_blocks  = cache_blocks > 0 ? cache_blocks
+                                         : SIXPACK_CACHE_BLOCKS;
+  pack->cache         = (sixpack_block *)calloc(pack->cache_blocks,
+                                                sizeof(sixpack_block));
+  if (!pack->cache)
+    {
+      sixpack_close(pack);
+      return NULL;
+    }
+
+  for (i = 0; i < (unsigned long)pack->cache_blocks; i++)
+    {
+      pack->cache[i].entry = NO_ENTRY;
+    }
+
+#if defined( SIXPACK_THREADS )
+  pack->last = NO_ENTRY;
+#endif /* if defined( SIXPACK_THREADS ) */
+
+  return pack;
+}
+
+sixpack *
+sixpack_open(const char *archive_file, int cache_blocks)
+{
+  return sixpack_open_file(archive_file, NULL, cache_blocks);
+}
+
+int
+sixpack_readahead(sixpack *pack, int threads, int blocks)
+{
+#if defined( SIXPACK_THREADS )
+  if (pack->pool)
+    {
+      return -1;
+    }
+
+  if (blocks <= 0)
+    {
+      blocks = SIXPACK_READAHEAD_BLOCKS;
+    }
+
+  /* Keep the window within half of the cache */
+  pack->max_ahead = blocks < pack->cache_blocks / 2 ? blocks
+                                                    : pack->cache_blocks / 2;
+  if (pack->max_ahead == 0)
+    {
+      return -1;
+    }
+
+  pack->pool = fastlz_pool_create(threads);
+  return pack->pool ? 0 : -1;
+#else  /* if defined( SIXPACK_THREADS ) */
+  (void)pack;
+  (void)threads;
+  (void)blocks;
+  return -1;
+#endif /* if defined( SIXPACK_THREADS ) */
+}
+
+sixpack_off
+sixpack_size(const sixpack *pack)
+{
+  return pack->size;
+}
+
+long
+sixpack_pread(sixpack *pack, void *buffer, size_t length, sixpack_off offset)
+{
+  unsigned char * out   = (unsigned char *)buffer;
+  size_t          done  = 0;
+  unsigned long   low   = 0;
+  unsigned long   high  = pack->count;
+
+  if (offset >= pack->size)
+    {
+      return 0;
+    }
+
+  if (length > pack->size - offset)
+    {
+      length = pack->size - offset;
+    }
+
+  if (length > LONG_MAX)
+    {
+      length = LONG_MAX;
+    }
+
+  /* Last block starting at or before offset */
+  while (high - low > 1)
+    {
+      unsigned long middle = low + ( high - low ) / 2;
+
+      if (entry_offset(pack, middle) <= offset)
+        {
+          low = middle;
+        }
+      else
+        {
+          high = middle;
+        }
+    }
+
+  for (; done < length && low < pack->count; low++)
+    {
+      sixpack_block * block  = load_block(pack, low);
+      sixpack_off     start  = offset + done - entry_offset(pack, low);
+      size_t          n;
+
+      if (!block)
+        {
+          return -1;
+        }
+
+      n = block->length - start < length - done ? block->length - start
+                                                : length - done;
+      memcpy(out + done, block->data + start, n);
+      done += n;
+    }
+
+  return (long)done;
+}
+
+void
+sixpack_close(sixpack *pack)
+{
+  int c;
+
+  if (!pack)
+    {
+      return;
+    }
+
+#if defined( SIXPACK_THREADS )
+  /* Completes the pending blocks first */
+  if (pack->pool)
+    {
+      fastlz_pool_destroy(pack->pool);
+    }
+#endif /* if defined( SIXPACK_THREADS ) */
+
+  for (c = 0; pack->cache && c < pack->cache_blocks; c++)
+    {
+      FREE(pack->cache[c].data);
+#if defined( SIXPACK_THREADS )
+      FREE(pack->cache[c].input);
+#endif /* if defined( SIXPACK_THREADS ) */
+    }
+
+  if (pack->f)
+    {
+      fclose(pack->f);
+    }
+
+  FREE(pack->cache);
+  FREE(pack->entries);
+  FREE(pack->compressed);
+  free(pack);
+}
@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * 6PACK - file compressor using FastLZ (lightning-fast compression library)
+ *
+ * Copyright (c) 2007-2020 Ariya Hidayat <ariya.hidayat@gmail.com>
+ * Copyright (c) 2023 Jeffrey H. Johnson <trnsz@pobox.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ *  * The above copyright notice and this permission notice shall be
+ *    included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SIXPACK_H
+# define SIXPACK_H
+
+# include <stddef.h>
+# include <stdio.h>
+
+# include "sixpack_io.h"
+
+/* Decoded blocks kept by default */
+# define SIXPACK_CACHE_BLOCKS         16
+
+/* Blocks decoded ahead of sequential reads by default */
+# define SIXPACK_READAHEAD_BLOCKS     8
+
+/*
+ * Random access to the data of a seekable 6pack archive, i.e. one written
+ * with 6pack --index. The block index at the end of the archive tells
+ * which chunks hold a range; only those are read, checked and
+ * decompressed. The most recently used blocks are kept decoded, so that
+ * reads of a hot region cost a copy.
+ *
+ * A handle must not be used by several threads at once.
+ */
+
+typedef struct sixpack sixpack;
+
+/* A file of an archive, as listed by its central directory */
+typedef struct sixpack_member
+{
+  sixpack_off    offset;     /* of its file entry chunk in the archive */
+  sixpack_off    size;
+  const char *   name;
+} sixpack_member;
+
+/*
+ * Read the central directory of the archive f, of archive_size bytes, into
+ * *members, in the order of the archive; free() it after use. Returns the
+ * number of files, or -1 if the archive has no directory (e.g. written by
+ * an older 6pack) or it is damaged.
+ */
+
+long sixpack_members(FILE *f, sixpack_off archive_size,
+                     sixpack_member **members);
+
+/*
+ * Open the file of the archive called name, or the first file if name is
+ * NULL, keeping up to cache_blocks decoded blocks (SIXPACK_CACHE_BLOCKS if
+ * 0). Returns NULL if the archive can not be read, is not a 6pack archive,
+ * has no block index, or does not hold the file.
+ */
+
+sixpack *sixpack_open_file(const char *archive_file, const char *name,
+                           int cache_blocks);
+
+/* Open the first file of the archive; see sixpack_open_file */
+sixpack *sixpack_open(const char *archive_file, int cache_blocks);
+
+/*
+ * Decode blocks ahead of sequential reads on threads workers, built with
+ * -DSIXPACK_THREADS. Once reads go from block to block in order, up to
+ * blocks of the next ones (SIXPACK_READAHEAD_BLOCKS if 0, at most half of
+ * the cache) are read and handed to the workers, so that the following
+ * reads find them decoded; a jump elsewhere stops the read-ahead until
+ * reads are in order again. Returns 0, or -1 if it is not supported or
+ * already on, or if the workers can not be started.
+ */
+
+int sixpack_readahead(sixpack *pack, int threads, int blocks);
+
+/* Size of the file in bytes */
+sixpack_off sixpack_size(const sixpack *pack);
+
+/*
+ * Read up to length bytes of the file at offset into buffer. Returns the
+ * number of bytes read, less than length only at the end of the file, or
+ * -1 if a chunk is damaged or can not be read.
+ */
+
+long sixpack_pread(sixpack *pack, void *buffer, size_t length,
+                   sixpack_off offset);
+
+/* Close the archive and free the cache */
+void sixpack_close(sixpack *pack);
+
+#endif /* SIXPACK_H */
@@ -0,0 +1,888 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * 6PACK - file compressor using FastLZ (lightning-fast compression library)
+ *
+ * Copyright (c) 2007-2020 Ariya Hidayat <ariya.hidayat@gmail.com>
+ * Copyright (c) 2023 Jeffrey H. Johnson <trnsz@pobox.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ *  * The above copyright notice and this permission notice shall be
+ *    included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* 64-bit file offsets, also on 32-bit systems */
+#if !defined( _FILE_OFFSET_BITS )
+# define _FILE_OFFSET_BITS  64
+#endif /* if !defined( _FILE_OFFSET_BITS ) */
+
+/* io_uring needs Linux and the GCC atomic builtins for the ring indices */
+#if defined( SIXPACK_URING ) && defined( __linux__ )  \
+  && ( defined( __GNUC__ ) || defined( __clang__ ))
+# define SIXPACK_IO_URING
+# if !defined( _GNU_SOURCE )
+#  define _GNU_SOURCE  /* for O_DIRECT */
+# endif /* if !defined( _GNU_SOURCE ) */
+#endif /* if defined( SIXPACK_URING ) && defined( __linux__ )
+           && ( defined( __GNUC__ ) || defined( __clang__ )) */
+
+#if defined ( WIN32 )  || defined( __NT__ ) \
+  || defined( _WIN32 ) || defined( __WIN32__ )
+# define SIXPACK_IO_WIN32
+#elif !defined( _DEFAULT_SOURCE )
+# define _DEFAULT_SOURCE
+#endif /* if defined ( WIN32 )  || defined( __NT__ )
+           || defined( _WIN32 ) || defined( __WIN32__ ) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sixpack_io.h"
+
+#if defined( SIXPACK_IO_WIN32 )
+# include <fcntl.h>
+# include <io.h>
+#else  /* if defined( SIXPACK_IO_WIN32 ) */
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <unistd.h>
+#endif /* if defined( SIXPACK_IO_WIN32 ) */
+
+#if defined( SIXPACK_IO_URING )
+# include <errno.h>
+# include <linux/io_uring.h>
+# include <sys/stat.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+#endif /* if defined( SIXPACK_IO_URING ) */
+
+#undef FREE
+#define FREE(p) do  \
+  {                 \
+    free((p));      \
+    (p) = NULL;     \
+  } while(0)
+
+/* Seeks and positions beyond 2 GB */
+#if defined( SIXPACK_IO_WIN32 )
+typedef __int64 io_off;
+# define io_fseek(f, o, w)  _fseeki64((f), (io_off)( o ), (w))
+# define io_ftell(f)        _ftelli64((f))
+#else  /* if defined( SIXPACK_IO_WIN32 ) */
+typedef off_t io_off;
+# define io_fseek(f, o, w)  fseeko((f), (io_off)( o ), (w))
+# define io_ftell(f)        ftello((f))
+#endif /* if defined( SIXPACK_IO_WIN32 ) */
+
+/* Buffers at least this large are aligned for transparent huge pages */
+#define IO_HUGE_PAGE  2097152
+
+/* State of a buffer */
+#define IO_IDLE       0
+#define IO_PENDING    1
+#define IO_DONE       2
+
+#if defined( SIXPACK_IO_URING )
+
+/* Submission and completion rings shared with the kernel */
+typedef struct io_ring
+{
+  int                    fd;
+  int                    fixed;
+  unsigned *             sq_head;
+  unsigned *             sq_tail;
+  unsigned *             sq_mask;
+  unsigned *             sq_array;
+  struct io_uring_sqe *  sqes;
+  unsigned *             cq_head;
+  unsigned *             cq_tail;
+  unsigned *             cq_mask;
+  struct io_uring_cqe *  cqes;
+  void *                 sq_map;
+  void *                 cq_map;
+  size_t                 sq_size;
+  size_t                 cq_size;
+  size_t                 sqes_size;
+} io_ring;
+
+#endif /* if defined( SIXPACK_IO_URING ) */
+
+struct sixpack_io
+{
+  FILE *           f;
+  int              writing;
+  int              async;
+  int              direct;    /* O_DIRECT set on the file */
+  int              fd_flags;  /* before it was set */
+  size_t           block;
+  int              depth;
+  unsigned char ** buffers;
+  size_t *         lengths;
+  long *           results;
+  sixpack_off *    offsets;
+  int *            states;
+  sixpack_off      offset;    /* of the next request */
+  sixpack_off      position;  /* after the last block handed out */
+  int              next;      /* buffer handed out or filled next */
+  int              held;      /* buffer handed out last, or -1 */
+  int              eof;
+  int              error;
+#if defined( SIXPACK_IO_URING )
+  io_ring          ring;
+  struct iovec *   iovecs;
+  unsigned *       queued;    /* position in the submission ring */
+  int              lost;      /* a request can not be reaped */
+#endif /* if defined( SIXPACK_IO_URING ) */
+};
+
+#if defined( SIXPACK_IO_URING )
+
+static void
+io_ring_free(io_ring *r)
+{
+  if (r->sqes)
+    {
+      munmap(r->sqes, r->sqes_size);
+    }
+
+  if (r->cq_map && r->cq_map != r->sq_map)
+    {
+      munmap(r->cq_map, r->cq_size);
+    }
+
+  if (r->sq_map)
+    {
+      munmap(r->sq_map, r->sq_size);
+    }
+
+  if (r->fd >= 0)
+    {
+      close(r->fd);
+    }
+}
+
+/* Returns 0, or -1 if io_uring is not available */
+static int
+io_ring_setup(io_ring *r, unsigned entries)
+{
+  struct io_uring_params  p;
+  unsigned char *         sq;
+  unsigned char *         cq;
+
+  memset(r, 0, sizeof(io_ring));
+  memset(&p, 0, sizeof(p));
+  r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (r->fd < 0)
+    {
+      return -1;
+    }
+
+  r->sq_size  = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_size  = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      if (r->cq_size > r->sq_size)
+        {
+          r->sq_size = r->cq_size;
+        }
+
+      r->cq_size = r->sq_size;
+    }
+
+  r->sq_map = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  if (r->sq_map == MAP_FAILED)
+    {
+      r->sq_map = NULL;
+      io_ring_free(r);
+      return -1;
+    }
+
+  r->cq_map = r->sq_map;
+  if (!( p.features & IORING_FEAT_SINGLE_MMAP ))
+    {
+      r->cq_map = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+      if (r->cq_map == MAP_FAILED)
+        {
+          r->cq_map = NULL;
+          io_ring_free(r);
+          return -1;
+        }
+    }
+
+  r->sqes_size  = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes       = (struct io_uring_sqe *)mmap(
+    NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+    r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED)
+    {
+      r->sqes = NULL;
+      io_ring_free(r);
+      return -1;
+    }
+
+  sq           = (unsigned char *)r->sq_map;
+  cq           = (unsigned char *)r->cq_map;
+  r->sq_head   = (unsigned *)( sq + p.sq_off.head );
+  r->sq_tail   = (unsigned *)( sq + p.sq_off.tail );
+  r->sq_mask   = (unsigned *)( sq + p.sq_off.ring_mask );
+  r->sq_array  = (unsigned *)( sq + p.sq_off.array );
+  r->cq_head   = (unsigned *)( cq + p.cq_off.head );
+  r->cq_tail   = (unsigned *)( cq + p.cq_off.tail );
+  r->cq_mask   = (unsigned *)( cq + p.cq_off.ring_mask );
+  r->cqes      = (struct io_uring_cqe *)( cq + p.cq_off.cqes );
+
+  return 0;
+}
+
+/*
+ * Hand the queued requests to the kernel, and wait for a completion if
+ * wait is set. Interrupted or busy calls are made again. Returns 0, or -1
+ * if the ring failed.
+ */
+
+static int
+io_ring_enter(io_ring *r, int wait)
+{
+  for (;;)
+    {
+      unsigned queued = *r->sq_tail
+                        - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+      if (syscall(__NR_io_uring_enter, r->fd, queued, wait ? 1 : 0,
+                  wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0) >= 0)
+        {
+          return 0;
+        }
+
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+          return -1;
+        }
+    }
+}
+
+/*
+ * Queue a read or write of buffer index and hand it to the kernel. The
+ * buffer stays pending until its completion is reaped, even if the kernel
+ * could not be entered: it may have taken the request anyway.
+ */
+
+static void
+io_submit(sixpack_io *io, int index, size_t length)
+{
+  io_ring *              r     = &io->ring;
+  unsigned               tail  = *r->sq_tail;
+  unsigned               slot  = tail & *r->sq_mask;
+  struct io_uring_sqe *  sqe   = &r->sqes[slot];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->fd         = fileno(io->f);
+  sqe->off        = io->offset;
+  sqe->user_data  = index;
+  if (r->fixed)
+    {
+      sqe->opcode     = io->writing ? IORING_OP_WRITE_FIXED
+                                    : IORING_OP_READ_FIXED;
+      sqe->addr       = (unsigned long)io->buffers[index];
+      sqe->len        = length;
+      sqe->buf_index  = index;
+    }
+  else
+    {
+      io->iovecs[index].iov_len  = length;
+      sqe->opcode                = io->writing ? IORING_OP_WRITEV
+                                               : IORING_OP_READV;
+      sqe->addr                  = (unsigned long)&io->iovecs[index];
+      sqe->len                   = 1;
+    }
+
+  io->lengths[index]  = length;
+  io->offsets[index]  = io->offset;
+  io->states[index]   = IO_PENDING;
+  io->queued[index]   = tail;
+  io->offset         += length;
+
+  r->sq_array[slot] = slot;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  if (io_ring_enter(r, 0) < 0)
+    {
+      io->error = 1;
+    }
+}
+
+/*
+ * Finish what a short read or write left, synchronously; this is rare
+ * for regular files, other than reads at the end.
+ */
+
+static void
+io_complete(sixpack_io *io, int index)
+{
+  long done = io->results[index];
+
+  while (done >= 0 && (size_t)done < io->lengths[index])
+    {
+      /* Unaligned for O_DIRECT, and for a file only at its end */
+      if (io->direct && !io->writing)
+        {
+          break;
+        }
+
+      unsigned char *  p  = io->buffers[index] + done;
+      size_t           n  = io->lengths[index] - done;
+      sixpack_off      o  = io->offsets[index] + done;
+      long             r  = io->writing
+                            ? (long)pwrite(fileno(io->f), p, n, (off_t)o)
+                            : (long)pread(fileno(io->f), p, n, (off_t)o);
+
+      if (r < 0)
+        {
+          done = -1;
+        }
+      else if (r == 0)
+        {
+          break;
+        }
+      else
+        {
+          done += r;
+        }
+    }
+
+  io->results[index] = done;
+  if (done < 0 || ( io->writing && (size_t)done != io->lengths[index] ))
+    {
+      io->error = 1;
+    }
+}
+
+/*
+ * Wait until buffer index is no longer in flight. Returns 0, or -1 if the
+ * ring failed while the kernel still has the request: the buffer must then
+ * be neither reused nor freed.
+ */
+
+static int
+io_wait(sixpack_io *io, int index)
+{
+  io_ring *r = &io->ring;
+
+  while (io->states[index] == IO_PENDING)
+    {
+      unsigned head  = *r->cq_head;
+      unsigned tail  = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+      if (head == tail)
+        {
+          if (io_ring_enter(r, 1) < 0)
+            {
+              unsigned taken = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+              io->error = 1;
+
+              /* Never taken by the kernel, so never in flight */
+              if ((int)( taken - io->queued[index] ) <= 0)
+                {
+                  io->states[index]   = IO_DONE;
+                  io->results[index]  = -1;
+                  continue;
+                }
+
+              io->lost = 1;
+              return -1;
+            }
+
+          continue;
+        }
+
+      for (; head != tail; head++)
+        {
+          struct io_uring_cqe * cqe  = &r->cqes[head & *r->cq_mask];
+          int                   i    = (int)cqe->user_data;
+
+          io->results[i]  = cqe->res;
+          io->states[i]   = IO_DONE;
+        }
+
+      __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+  if (io->states[index] == IO_DONE)
+    {
+      io_complete(io, index);
+      io->states[index] = IO_IDLE;
+    }
+
+  return 0;
+}
+
+/* Switch to O_DIRECT if the transfers are aligned and the file allows it */
+static void
+io_start_direct(sixpack_io *io)
+{
+  int fd = fileno(io->f);
+
+  io->fd_flags = fcntl(fd, F_GETFL);
+  if (io->block % SIXPACK_IO_ALIGN != 0
+      || io->offset % SIXPACK_IO_ALIGN != 0 || io->fd_flags < 0)
+    {
+      return;
+    }
+
+  io->direct = fcntl(fd, F_SETFL, io->fd_flags | O_DIRECT) == 0;
+}
+
+/* Use io_uring for a regular file, if the kernel allows it */
+static void
+io_start_async(sixpack_io *io, int flags)
+{
+  struct stat  st;
+  int          i;
+
+  if (fstat(fileno(io->f), &st) != 0 || !S_ISREG(st.st_mode))
+    {
+      return;
+    }
+
+  io->iovecs  = (struct iovec *)calloc(io->depth, sizeof(struct iovec));
+  io->queued  = (unsigned *)calloc(io->depth, sizeof(unsigned));
+  if (!io->iovecs || !io->queued || io_ring_setup(&io->ring, io->depth) < 0)
+    {
+      FREE(io->iovecs);
+      FREE(io->queued);
+      return;
+    }
+
+  for (i = 0; i < io->depth; i++)
+    {
+      io->iovecs[i].iov_base  = io->buffers[i];
+      io->iovecs[i].iov_len   = io->block;
+    }
+
+  /* Registered buffers save the page pinning on every request */
+  io->ring.fixed = syscall(__NR_io_uring_register, io->ring.fd,
+                           IORING_REGISTER_BUFFERS, io->iovecs, io->depth)
+                   == 0;
+
+  /* Requests use explicit offsets from the current position */
+  fflush(io->f);
+  io->offset    = (sixpack_off)io_ftell(io->f);
+  io->position  = io->offset;
+  io->async     = 1;
+  if (flags & SIXPACK_IO_DIRECT)
+    {
+      io_start_direct(io);
+    }
+}
+
+#endif /* if defined( SIXPACK_IO_URING ) */
+
+static sixpack_io *
+io_create(FILE *f, int writing, size_t block, int depth, int flags)
+{
+  sixpack_io * io  = (sixpack_io *)calloc(1, sizeof(sixpack_io));
+  int          i;
+
+  if (!io)
+    {
+      return NULL;
+    }
+
+  io->f        = f;
+  io->writing  = writing;
+  io->block    = block;
+  io->depth    = depth < 1 ? 1 : depth;
+  io->held     = -1;
+  io->buffers  = (unsigned char **)calloc(io->depth, sizeof(unsigned char *));
+  io->lengths  = (size_t *)calloc(io->depth, sizeof(size_t));
+  io->results  = (long *)calloc(io->depth, sizeof(long));
+  io->offsets  = (sixpack_off *)calloc(io->depth, sizeof(sixpack_off));
+  io->states   = (int *)calloc(io->depth, sizeof(int));
+  if (!io->buffers || !io->lengths || !io->results || !io->offsets
+      || !io->states)
+    {
+      sixpack_io_close(io);
+      return NULL;
+    }
+
+  /* Page aligned, as required by O_DIRECT and cheaper to pin */
+  for (i = 0; i < io->depth; i++)
+    {
+      io->buffers[i] = (unsigned char *)sixpack_io_alloc(block);
+      if (!io->buffers[i])
+        {
+          sixpack_io_close(io);
+          return NULL;
+        }
+    }
+
+#if !defined( SIXPACK_IO_WIN32 ) && defined( POSIX_FADV_SEQUENTIAL )
+  /* Let the kernel read ahead further than for random access */
+  if (!writing && !( flags & SIXPACK_IO_DIRECT ))
+    {
+      (void)posix_fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif /* if !defined( SIXPACK_IO_WIN32 )
+           && defined( POSIX_FADV_SEQUENTIAL ) */
+
+#if defined( SIXPACK_IO_URING )
+  io_start_async(io, flags);
+#else  /* if defined( SIXPACK_IO_URING ) */
+  (void)flags;
+#endif /* if defined( SIXPACK_IO_URING ) */
+
+  return io;
+}
+
+sixpack_io *
+sixpack_io_reader(FILE *f, size_t block, int depth, int flags)
+{
+  sixpack_io *io = io_create(f, 0, block, depth, flags);
+
+#if defined( SIXPACK_IO_URING )
+  if (io && io->async)
+    {
+      int i;
+
+      for (i = 0; i < io->depth; i++)
+        {
+          io_submit(io, i, io->block);
+        }
+    }
+
+#endif /* if defined( SIXPACK_IO_URING ) */
+  return io;
+}
+
+sixpack_io *
+sixpack_io_writer(FILE *f, size_t block, int depth, int flags)
+{
+  return io_create(f, 1, block, depth, flags);
+}
+
+size_t
+sixpack_io_read(sixpack_io *io, const unsigned char **data)
+{
+  size_t n;
+
+  if (!io->async)
+    {
+      *data = io->buffers[0];
+      return io->eof ? 0 : fread(io->buffers[0], 1, io->block, io->f);
+    }
+
+#if defined( SIXPACK_IO_URING )
+
+  /* The block handed out last is free again: read further ahead */
+  if (io->held >= 0 && !io->eof)
+    {
+      io_submit(io, io->held, io->block);
+    }
+
+  io->held = -1;
+  if (io->eof)
+    {
+      return 0;
+    }
+
+  if (io_wait(io, io->next) < 0 || io->results[io->next] < 0)
+    {
+      io->error  = 1;
+      io->eof    = 1;
+      return 0;
+    }
+
+  n             = (size_t)io->results[io->next];
+  *data         = io->buffers[io->next];
+  io->position  = io->offsets[io->next] + n;
+  io->held      = io->next;
+  io->next      = ( io->next + 1 ) % io->depth;
+  if (n < io->block)
+    {
+      io->eof = 1;
+    }
+
+  return n;
+#else  /* if defined( SIXPACK_IO_URING ) */
+  (void)n;
+  return 0;
+#endif /* if defined( SIXPACK_IO_URING ) */
+}
+
+int
+sixpack_io_write(sixpack_io *io, const void *data, size_t length)
+{
+  if (!io->async)
+    {
+      return fwrite(data, 1, length, io->f) == length ? 0 : -1;
+    }
+
+#if defined( SIXPACK_IO_URING )
+  while (length > 0 && !io->error)
+    {
+      const unsigned char * p     = (const unsigned char *)data;
+      size_t                used  = io->lengths[io->next];
+      size_t                n     = io->block - used < length
+                                      ? io->block - used
+                                      : length;
+
+      memcpy(io->buffers[io->next] + used, p, n);
+      io->lengths[io->next]  += n;
+      data                    = p + n;
+      length                 -= n;
+
+      /* Full: write it behind and fill the next one */
+      if (io->lengths[io->next] == io->block)
+        {
+          io_submit(io, io->next, io->block);
+          io->next = ( io->next + 1 ) % io->depth;
+          if (io_wait(io, io->next) < 0)
+            {
+              break;
+            }
+
+          io->lengths[io->next] = 0;
+        }
+    }
+
+#endif /* if defined( SIXPACK_IO_URING ) */
+  return io->error ? -1 : 0;
+}
+
+int
+sixpack_io_close(sixpack_io *io)
+{
+  int  error;
+  int  i;
+
+#if defined( SIXPACK_IO_URING )
+  if (io->async)
+    {
+      sixpack_off   end     = io->offset + io->lengths[io->next];
+      size_t        length  = io->lengths[io->next];
+
+      /* O_DIRECT writes whole aligned blocks; the padding is cut below */
+      if (io->writing && io->direct && length % SIXPACK_IO_ALIGN != 0)
+        {
+          size_t pad = SIXPACK_IO_ALIGN - length % SIXPACK_IO_ALIGN;
+
+          memset(io->buffers[io->next] + length, 0, pad);
+          length += pad;
+        }
+
+      if (io->writing && length > 0 && io->states[io->next] == IO_IDLE)
+        {
+          io_submit(io, io->next, length);
+        }
+
+      for (i = 0; i < io->depth; i++)
+        {
+          io_wait(io, i);
+        }
+
+      /* Buffers the kernel may still use are left to it, not freed */
+      io_ring_free(&io->ring);
+      if (!io->lost)
+        {
+          FREE(io->iovecs);
+        }
+
+      FREE(io->queued);
+
+      if (io->writing)
+        {
+          if (io->direct && end < io->offset
+              && ftruncate(fileno(io->f), (off_t)end) != 0)
+            {
+              io->error = 1;
+            }
+
+          io->offset = end;
+        }
+
+      if (io->direct)
+        {
+          (void)fcntl(fileno(io->f), F_SETFL, io->fd_flags);
+        }
+
+      /* Leave the FILE after the data consumed or produced */
+      io_fseek(io->f, io->writing ? io->offset : io->position, SEEK_SET);
+    }
+
+#endif /* if defined( SIXPACK_IO_URING ) */
+  error = io->error || ( !io->async && ferror(io->f));
+  for (i = 0; io->buffers && i < io->depth; i++)
+    {
+#if defined( SIXPACK_IO_URING )
+      if (io->lost && io->states[i] == IO_PENDING)
+        {
+          continue;
+        }
+#endif /* if defined( SIXPACK_IO_URING ) */
+      FREE(io->buffers[i]);
+    }
+
+  FREE(io->buffers);
+  FREE(io->lengths);
+  FREE(io->results);
+  FREE(io->offsets);
+  FREE(io->states);
+  free(io);
+
+  return error ? -1 : 0;
+}
+
+int
+sixpack_io_direct(const sixpack_io *io)
+{
+  return io->direct;
+}
+
+int
+sixpack_io_size(FILE *f, sixpack_off *size)
+{
+  io_off end = -1;
+
+  if (io_fseek(f, 0, SEEK_END) == 0)
+    {
+      end = io_ftell(f);
+    }
+
+  if (io_fseek(f, 0, SEEK_SET) != 0 || end < 0)
+    {
+      return -1;
+    }
+
+  *size = (sixpack_off)end;
+  return 0;
+}
+
+int
+sixpack_io_seek(FILE *f, sixpack_off offset)
+{
+  return io_fseek(f, offset, SEEK_SET) == 0 ? 0 : -1;
+}
+
+char *
+sixpack_io_number(sixpack_off value, char *buffer)
+{
+  char *p = buffer + SIXPACK_OFF_DIGITS - 1;
+
+  *p = 0;
+  do
+    {
+      *--p    = '0' + (char)( value % 10 );
+      value  /= 10;
+    }
+  while (value > 0);
+
+  memmove(buffer, p, buffer + SIXPACK_OFF_DIGITS - p);
+  return buffer;
+}
+
+sixpack_off
+sixpack_io_parse(const char *text, char **end)
+{
+  sixpack_off value = 0;
+
+  while (*text >= '0' && *text <= '9')
+    {
+      value = value * 10 + ( *text++ - '0' );
+    }
+
+  *end = (char *)text;
+  return value;
+}
+
+void *
+sixpack_io_alloc(size_t size)
+{
+#if defined( SIXPACK_IO_WIN32 )
+  return malloc(size);
+#else  /* if defined( SIXPACK_IO_WIN32 ) */
+  void *  p;
+  size_t  align = size >= IO_HUGE_PAGE ? IO_HUGE_PAGE : SIXPACK_IO_ALIGN;
+
+  if (posix_memalign(&p, align, size) != 0)
+    {
+      return NULL;
+    }
+
+# if defined( MADV_HUGEPAGE )
+  /* A hint only, failures do not matter */
+  if (align == IO_HUGE_PAGE)
+    {
+      (void)madvise(p, size - size % IO_HUGE_PAGE, MADV_HUGEPAGE);
+    }
+# endif /* if defined( MADV_HUGEPAGE ) */
+
+  return p;
+#endif /* if defined( SIXPACK_IO_WIN32 ) */
+}
+
+FILE *
+sixpack_io_stdin(void)
+{
+#if defined( SIXPACK_IO_WIN32 )
+  if (_setmode(_fileno(stdin), _O_BINARY) < 0)
+    {
+      return NULL;
+    }
+#endif /* if defined( SIXPACK_IO_WIN32 ) */
+
+  return stdin;
+}
+
+FILE *
+sixpack_io_stdout(void)
+{
+  FILE * f;
+  int    fd;
+
+  /* The data goes to a duplicate, standard output becomes standard error */
+  fflush(stdout);
+  fd = dup(fileno(stdout));
+  if (fd < 0)
+    {
+      return NULL;
+    }
+
+  f = fdopen(fd, "wb");
+  if (!f || dup2(fileno(stderr), fileno(stdout)) < 0)
+    {
+      if (f)
+        {
+          fclose(f);
+        }
+      else
+        {
+          close(fd);
+        }
+
+      return NULL;
+    }
+
+#if defined( SIXPACK_IO_WIN32 )
+  _setmode(fd, _O_BINARY);
+#endif /* if defined( SIXPACK_IO_WIN32 ) */
+
+  return f;
+}
@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * 6PACK - file compressor using FastLZ (lightning-fast compression library)
+ *
+ * Copyright (c) 2007-2020 Ariya Hidayat <ariya.hidayat@gmail.com>
+ * Copyright (c) 2023 Jeffrey H. Johnson <trnsz@pobox.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ *  * The above copyright notice and this permission notice shall be
+ *    included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SIXPACK_IO_H
+# define SIXPACK_IO_H
+
+# include <stdint.h>
+# include <stdio.h>
+
+/* Sizes and offsets in files, 64-bit whatever the width of a long */
+typedef uint64_t sixpack_off;
+
+/* Digits of the largest sixpack_off, and a terminating zero */
+# define SIXPACK_OFF_DIGITS           21
+
+/* Buffers kept in flight by default */
+# define SIXPACK_IO_DEPTH             4
+
+/* Size of the write buffers used by default */
+# define SIXPACK_IO_WRITE_BLOCK       262144
+
+/* Flag: bypass the page cache with O_DIRECT where possible */
+# define SIXPACK_IO_DIRECT            1
+
+/* Alignment of O_DIRECT transfers, and of the buffers */
+# define SIXPACK_IO_ALIGN             4096
+
+/*
+ * Sequential reads or writes on an open file, done ahead of (or behind)
+ * the caller with several requests in flight.
+ *
+ * Built with -DSIXPACK_URING on Linux, regular files use an io_uring set
+ * up with raw system calls, with registered buffers when the memory lock
+ * limit allows it. Other files, other systems, and kernels or sandboxes
+ * without io_uring use plain stdio on the same FILE.
+ *
+ * With SIXPACK_IO_DIRECT, a regular file on io_uring is switched to
+ * O_DIRECT, if the block size and the current position are multiples of
+ * SIXPACK_IO_ALIGN and the file system allows it. The last write is then
+ * padded, and the padding cut off again when the engine is closed.
+ * Otherwise the flag is ignored and the page cache is used as usual.
+ *
+ * The FILE must not be used while the engine is open. When it is closed,
+ * the FILE is positioned after the last byte read or written.
+ */
+
+typedef struct sixpack_io sixpack_io;
+
+/*
+ * Start reading f from its current position in blocks of the given size,
+ * with depth blocks requested ahead. Returns NULL if out of memory.
+ */
+
+sixpack_io *sixpack_io_reader(FILE *f, size_t block, int depth, int flags);
+
+/*
+ * Start writing f at its current position, through depth buffers of the
+ * given size. Returns NULL if out of memory.
+ */
+
+sixpack_io *sixpack_io_writer(FILE *f, size_t block, int depth, int flags);
+
+/*
+ * Next block of the file, in *data until the next call. The block is full
+ * except at the end of the file. Returns its size, 0 at the end of the file
+ * or after an error.
+ */
+
+size_t sixpack_io_read(sixpack_io *io, const unsigned char **data);
+
+/*
+ * Append length bytes to the file. Returns 0, or -1 if a write failed.
+ */
+
+int sixpack_io_write(sixpack_io *io, const void *data, size_t length);
+
+/*
+ * Finish pending requests and free the engine. Returns 0, or -1 if a read
+ * or write failed.
+ */
+
+int sixpack_io_close(sixpack_io *io);
+
+/* Non-zero if the engine bypasses the page cache with O_DIRECT */
+int sixpack_io_direct(const sixpack_io *io);
+
+/*
+ * Size of the file f, which is left at its start. Returns -1 if it can not
+ * be found, e.g. for a pipe.
+ */
+
+int sixpack_io_size(FILE *f, sixpack_off *size);
+
+/* Move to offset in f, also beyond 4 GB. Returns 0, or -1 on failure. */
+int sixpack_io_seek(FILE *f, sixpack_off offset);
+
+/*
+ * Decimal digits of value in buffer, of SIXPACK_OFF_DIGITS bytes, for
+ * printf with %s, as C90 has no conversion for 64-bit integers. Returns
+ * buffer.
+ */
+
+char *sixpack_io_number(sixpack_off value, char *buffer);
+
+/*
+ * Decimal number at the start of text, as strtoul() but of 64 bits; *end
+ * is set past its digits, to text if there are none.
+ */
+
+sixpack_off sixpack_io_parse(const char *text, char **end);
+
+/*
+ * Heap memory for blocks, aligned to SIXPACK_IO_ALIGN as O_DIRECT needs,
+ * and to huge pages when that large. Release it with free(). Returns NULL
+ * if out of memory.
+ */
+
+void *sixpack_io_alloc(size_t size);
+
+/*
+ * Standard input for binary data. Returns NULL if it can not be switched
+ * to binary mode.
+ */
+
+FILE *sixpack_io_stdin(void);
+
+/*
+ * Standard output for binary data, as a new FILE. From then on, whatever
+ * is printed to stdout goes to standard error instead, so that messages
+ * do not mix with the data. Returns NULL on failure; call it only once.
+ */
+
+FILE *sixpack_io_stdout(void);
+
+#endif /* SIXPACK_IO_H */
@@ -42,6 +42,17 @@
 #endif /* if defined( FASTLZ_USE_SAFE_DECOMPRESSOR )
            && ( FASTLZ_USE_SAFE_DECOMPRESSOR == 0 ) */
 
+/*
+ * Decompress in two stages: parse a batch of sequences, then execute
+ * the copies. Off by default.
+ */
+
+#if defined( FASTLZ_USE_TWO_STAGE_DECOMPRESSOR ) \
+  && ( FASTLZ_USE_TWO_STAGE_DECOMPRESSOR != 0 )
+# define FLZ_TWO_STAGE
+#endif /* if defined( FASTLZ_USE_TWO_STAGE_DECOMPRESSOR )
+           && ( FASTLZ_USE_TWO_STAGE_DECOMPRESSOR != 0 ) */
+
 /*
  * Give hints to the compiler for branch prediction optimization.
  */
@@ -264,7 +275,7 @@
     uint8_t *       q  = (uint8_t *)dest;
     unsigned int    c;
 
-    for (c = 0; c < count * 8; ++c)
+    for (c = 0; c < count; ++c)
       {
         *q++ = *p++;
       }
@@ -295,6 +306,10 @@
 #define HASH_SIZE         ( 1 << HASH_LOG )
 #define HASH_MASK         ( HASH_SIZE - 1 )
 
+#if ( HASH_SIZE * 4 ) > FASTLZ_WORKSPACE_SIZE
+# error FASTLZ_WORKSPACE_SIZE too small for the hash table
+#endif /* if ( HASH_SIZE * 4 ) > FASTLZ_WORKSPACE_SIZE */
+
 static uint16_t
 flz_hash(uint32_t v)
 {
@@ -397,8 +412,8 @@ flz1_match(uint32_t len, uint32_t distance, uint8_t *op)
   return op;
 }
 
-int
-fastlz1_compress(const void *input, int length, void *output)
+static int
+flz1_compress(const void *input, int length, void *output, uint32_t *htab)
 {
   const uint8_t * ip        = (const uint8_t *)input;
   const uint8_t * ip_start  = ip;
@@ -406,7 +421,6 @@ fastlz1_compress(const void *input, int length, void *output)
   const uint8_t * ip_limit  = ip + length - 12 - 1;
   uint8_t *       op        = (uint8_t *)output;
 
-  uint32_t        htab[HASH_SIZE];
   uint32_t        seq, hash;
 
   /* Initializes hash table */
@@ -480,6 +494,172 @@ fastlz1_compress(const void *input, int length, void *output)
   return op - (uint8_t *)output;
 }
 
+int
+fastlz1_compress(const void *input, int length, void *output)
+{
+  uint32_t htab[HASH_SIZE];
+
+  return flz1_compress(input, length, output, htab);
+}
+
+/*
+ * Decode up to max sequences starting at *pos, checking all bounds, so
+ * that the copies can be done without further checks.
+ *
+ * Returns the number of sequences (0 at the end of the block), or an error.
+ */
+
+static int
+flz_parse(int level, const uint8_t *input, uint32_t length, uint32_t *pos,
+          uint32_t *produced, uint32_t maxout, fastlz_sequence *seq, int max)
+{
+  uint32_t  ip   = *pos;
+  uint32_t  out  = *produced;
+  uint32_t  end  = level == 1 ? 2 : 1; /* smallest instruction */
+  int       n    = 0;
+
+  while (n < max && ( ip == 0 || length - ip >= end ))
+    {
+      fastlz_sequence * s     = &seq[n];
+      uint32_t          ctrl  = ip == 0 ? input[ip++] & 31 : input[ip++];
+
+      s->literal         = ip;
+      s->literal_length  = 0;
+      s->match_length    = 0;
+      s->distance        = 0;
+
+      if (ctrl < 32)
+        {
+          ctrl++;
+          if (ctrl > maxout - out)
+            {
+              return FASTLZ_ERROR_TOO_SMALL;
+            }
+
+          if (ctrl > length - ip)
+            {
+              return FASTLZ_ERROR_CORRUPT;
+            }
+
+          s->literal_length   = ctrl;
+          ip                 += ctrl;
+          out                += ctrl;
+
+          /* A match completes the sequence */
+          if (length - ip < end || input[ip] < 32)
+            {
+              n++;
+              continue;
+            }
+
+          ctrl = input[ip++];
+        }
+
+      {
+        uint32_t  len  = ( ctrl >> 5 ) - 1;
+        uint32_t  ofs  = ( ctrl & 31 ) << 8;
+        uint32_t  code;
+
+        if (len == 7 - 1)
+          {
+            do
+              {
+                if (ip >= length)
+                  {
+                    return FASTLZ_ERROR_CORRUPT;
+                  }
+
+                code   = input[ip++];
+                len   += code;
+              }
+            while (level == 2 && code == 255);
+          }
+
+        if (ip >= length)
+          {
+            return FASTLZ_ERROR_CORRUPT;
+          }
+
+        code   = input[ip++];
+        len   += 3;
+
+        /* match from 16-bit distance, which never ends a block */
+        if (level == 2 && code == 255 && ofs == ( 31 << 8 ))
+          {
+            if (length - ip < 3)
+              {
+                return FASTLZ_ERROR_CORRUPT;
+              }
+
+            ofs   = input[ip++] << 8;
+            ofs  += input[ip++];
+            ofs  += MAX_L2_DISTANCE;
+          }
+        else
+          {
+            ofs += code;
+          }
+
+        if (len > maxout - out)
+          {
+            return FASTLZ_ERROR_TOO_SMALL;
+          }
+
+        if (ofs >= out)
+          {
+            return FASTLZ_ERROR_CORRUPT;
+          }
+
+        s->match_length   = len;
+        s->distance       = ofs + 1;
+        out              += len;
+      }
+
+      n++;
+    }
+
+  *pos       = ip;
+  *produced  = out;
+
+  return n;
+}
+
+int
+fastlz_parse(fastlz_parser *parser, const void *input, int length,
+             fastlz_sequence *seq, int count)
+{
+  const uint8_t * ip        = (const uint8_t *)input;
+  uint32_t        pos       = parser->position;
+  uint32_t        produced  = parser->output;
+  int             n;
+
+  if (length <= 0 || count < 0)
+    {
+      return FASTLZ_ERROR_TOO_SMALL;
+    }
+
+  if (pos == 0)
+    {
+      parser->level = ( *ip >> 5 ) + 1;
+      if (parser->level != 1 && parser->level != 2)
+        {
+          return FASTLZ_ERROR_UNKNOWN_LEVEL;
+        }
+    }
+
+  n = flz_parse(parser->level, ip, length, &pos, &produced, 0x7fffffff, seq,
+                count);
+  if (n > 0)
+    {
+      parser->position  = pos;
+      parser->output    = produced;
+    }
+
+  return n;
+}
+
+#if !defined( FLZ_TWO_STAGE )
+
 int
 fastlz1_decompress(const void *input, int length, void *output, int maxout)
 {
@@ -531,6 +711,8 @@ fastlz1_decompress(const void *input, int length, void *output, int maxout)
   return op - (uint8_t *)output;
 }
 
+#endif /* if !defined( FLZ_TWO_STAGE ) */
+
 static uint8_t *
 flz2_match(uint32_t len, uint32_t distance, uint8_t *op)
 {
@@ -584,8 +766,8 @@ flz2_match(uint32_t len, uint32_t distance, uint8_t *op)
   return op;
 }
 
-int
-fastlz2_compress(const void *input, int length, void *output)
+static int
+flz2_compress(const void *input, int length, void *output, uint32_t *htab)
 {
   const uint8_t * ip        = (const uint8_t *)input;
   const uint8_t * ip_start  = ip;
@@ -593,7 +775,6 @@ fastlz2_compress(const void *input, int length, void *output)
   const uint8_t * ip_limit  = ip + length - 12 - 1;
   uint8_t *       op        = (uint8_t *)output;
 
-  uint32_t        htab[HASH_SIZE];
   uint32_t        seq, hash;
 
   /* Initializes hash table */
@@ -680,6 +861,16 @@ fastlz2_compress(const void *input, int length, void *output)
   return op - (uint8_t *)output;
 }
 
+int
+fastlz2_compress(const void *input, int length, void *output)
+{
+  uint32_t htab[HASH_SIZE];
+
+  return flz2_compress(input, length, output, htab);
+}
+
+#if !defined( FLZ_TWO_STAGE )
+
 int
 fastlz2_decompress(const void *input, int length, void *output, int maxout)
 {
@@ -710,6 +901,8 @@ fastlz2_decompress(const void *input, int length, void *output, int maxout)
               while (code == 255);
             }
 
+          /* A block may end right after the opcode: corrupt, as in flz_parse */
+          FASTLZ_BOUND_CHECK_CORRUPT(ip < ip_limit);
           code   = *ip++;
           ref   -= code;
           len   += 3;
@@ -752,6 +945,116 @@ fastlz2_decompress(const void *input, int length, void *output, int maxout)
   return op - (uint8_t *)output;
 }
 
+#else  /* if !defined( FLZ_TWO_STAGE ) */
+
+# include <string.h>
+
+/* Sequences parsed per batch */
+# define FLZ_SEQ_BATCH    256
+
+/*
+ * Execute the copies of count sequences checked by flz_parse. Copies are
+ * done in 8 and 32 byte steps when the buffers have room for the overrun.
+ */
+
+static uint8_t *
+flz_execute(const uint8_t *input, const uint8_t *ip_limit, uint8_t *op,
+            const uint8_t *op_limit, const fastlz_sequence *seq, int count)
+{
+  int i;
+
+  for (i = 0; i < count; i++)
+    {
+      const fastlz_sequence * s    = &seq[i];
+      const uint8_t *         ip   = input + s->literal;
+      uint32_t                len  = s->literal_length;
+
+      if (FASTLZ_LIKELY(ip_limit - ip >= 32 && op_limit - op >= 32))
+        {
+          flz_copy256(op, ip);
+        }
+      else
+        {
+          fastlz_memcpy(op, ip, len);
+        }
+
+      op  += len;
+      len  = s->match_length;
+      if (len > 0)
+        {
+          const uint8_t * ref = op - s->distance;
+
+          if (FASTLZ_LIKELY(s->distance >= 8
+                            && (uint32_t)( op_limit - op ) >= len + 8))
+            {
+              uint8_t *  q = op;
+              uint64_t   v;
+
+              do
+                {
+                  memcpy(&v, ref, 8);
+                  memcpy(q, &v, 8);
+                  ref  += 8;
+                  q    += 8;
+                }
+              while (q < op + len);
+            }
+          else
+            {
+              fastlz_memmove(op, ref, len);
+            }
+
+          op += len;
+        }
+    }
+
+  return op;
+}
+
+static int
+flz_decompress(int level, const void *input, int length, void *output,
+               int maxout)
+{
+  const uint8_t *  ip        = (const uint8_t *)input;
+  uint8_t *        op        = (uint8_t *)output;
+  uint32_t         pos       = 0;
+  uint32_t         produced  = 0;
+  fastlz_sequence  seq[FLZ_SEQ_BATCH];
+
+  if (length <= 0 || maxout < 0)
+    {
+      return 0;
+    }
+
+  for (;;)
+    {
+      int count = flz_parse(level, ip, length, &pos, &produced, maxout, seq,
+                            FLZ_SEQ_BATCH);
+
+      if (count <= 0)
+        {
+          return count < 0 ? count : (int)produced;
+        }
+
+      op = flz_execute(ip, ip + length, op, (uint8_t *)output + maxout, seq,
+                       count);
+    }
+}
+
+int
+fastlz1_decompress(const void *input, int length, void *output, int maxout)
+{
+  return flz_decompress(1, input, length, output, maxout);
+}
+
+int
+fastlz2_decompress(const void *input, int length, void *output, int maxout)
+{
+  return flz_decompress(2, input, length, output, maxout);
+}
+
+#endif /* if !defined( FLZ_TWO_STAGE ) */
+
 int
 fastlz_decompress(const void *input, int length, void *output, int maxout)
 {
@@ -787,3 +1090,256 @@ fastlz_compress_level(int level, const void *input, int length, void *output)
 
   return FASTLZ_ERROR_UNKNOWN_LEVEL;
 }
+
+int
+fastlz_compress_workspace(int level, const void *input, int length,
+                          void *output, void *workspace)
+{
+  if (level == 1)
+    {
+      return flz1_compress(input, length, output, (uint32_t *)workspace);
+    }
+
+  if (level == 2)
+    {
+      return flz2_compress(input, length, output, (uint32_t *)workspace);
+    }
+
+  return FASTLZ_ERROR_UNKNOWN_LEVEL;
+}
+
+int
+fastlz_compress_bound(int length)
+{
+  if (length < 0 || length > 0x7c000000)
+    {
+      return FASTLZ_ERROR_TOO_SMALL;
+    }
+
+  return FASTLZ_COMPRESS_BOUND(length);
+}
+
+/*
+ * Literals from anchor to end, searching them for matches of the level.
+ * The last tail bytes stay literals.
+ */
+
+static uint8_t *
+flz_transcode_literals(int level, const uint8_t *data, uint32_t anchor,
+                       uint32_t end, uint32_t tail, uint32_t *htab,
+                       uint8_t *op)
+{
+  uint32_t ip     = anchor;
+  uint32_t limit  = level == 1 ? MAX_L1_DISTANCE : MAX_FARDISTANCE;
+
+  while (ip + 4 <= end)
+    {
+      uint32_t  seq       = flz_readu32(data + ip) & 0xffffff;
+      uint32_t  hash      = flz_hash(seq);
+      uint32_t  ref       = htab[hash];
+      uint32_t  distance  = ip - ref;
+      uint32_t  len;
+
+      htab[hash] = ip;
+      if (ref >= ip || distance >= limit
+          || ( flz_readu32(data + ref) & 0xffffff ) != seq)
+        {
+          ip++;
+          continue;
+        }
+
+      for (len = 3; ip + len + tail < end && data[ref + len] == data[ip + len];
+           len++)
+        {
+          ;
+        }
+
+      /* Far, needs at least 5-byte match */
+      if (level == 2 && distance >= MAX_L2_DISTANCE && len < 5)
+        {
+          ip++;
+          continue;
+        }
+
+      op      = flz_finalize(ip - anchor, data + anchor, op);
+      op      = level == 1 ? flz1_match(len - 2, distance, op)
+                           : flz2_match(len - 2, distance, op);
+      ip     += len;
+      anchor  = ip;
+    }
+
+  return flz_finalize(end - anchor, data + anchor, op);
+}
+
+/*
+ * Pending match of len bytes ending at *anchor. A far match shorter than
+ * level 2 allows goes back to the literals, moving *anchor to its start.
+ */
+
+static uint8_t *
+flz_transcode_match(int level, uint32_t len, uint32_t distance,
+                    uint32_t *anchor, uint8_t *op)
+{
+  if (len == 0)
+    {
+      return op;
+    }
+
+  if (level == 2 && distance >= MAX_L2_DISTANCE && len < 5)
+    {
+      *anchor -= len;
+      return op;
+    }
+
+  return level == 1 ? flz1_match(len - 2, distance, op)
+                    : flz2_match(len - 2, distance, op);
+}
+
+int
+fastlz_transcode(int level, const void *input, int length, void *output,
+                 void *scratch, int maxscratch)
+{
+  const uint8_t *  in    = (const uint8_t *)input;
+  uint32_t *       htab  = (uint32_t *)scratch;
+  uint8_t *        data  = (uint8_t *)scratch + FASTLZ_WORKSPACE_SIZE;
+  uint8_t *        op    = (uint8_t *)output;
+  fastlz_sequence  seq[64];
+  uint32_t         ip, produced, pos, anchor, match_len, match_distance;
+  uint32_t         hash;
+  int              from, count, i;
+
+  if (level != 1 && level != 2)
+    {
+      return FASTLZ_ERROR_UNKNOWN_LEVEL;
+    }
+
+  if (length <= 0 || maxscratch < FASTLZ_WORKSPACE_SIZE)
+    {
+      return FASTLZ_ERROR_TOO_SMALL;
+    }
+
+  from = ( *in >> 5 ) + 1;
+  if (from != 1 && from != 2)
+    {
+      return FASTLZ_ERROR_UNKNOWN_LEVEL;
+    }
+
+  /* Nothing to convert */
+  if (from == level)
+    {
+      fastlz_memcpy(op, in, length);
+      return length;
+    }
+
+  for (hash = 0; hash < HASH_SIZE; ++hash)
+    {
+      htab[hash] = 0;
+    }
+
+  /*
+   * The block is decompressed into scratch along the way, for the literals
+   * and the match finder. Matches are kept pending so that pieces of a long
+   * level 1 match can be joined. Level 1 can not reach as far as level 2:
+   * such matches are turned into literals. Literal runs are searched again
+   * with the reach of the new level, which finds the far matches going to
+   * level 2 and near matches inside the dropped ones going to level 1.
+   */
+
+  ip              = 0;
+  produced        = 0;
+  pos             = 0;
+  anchor          = 0;
+  match_len       = 0;
+  match_distance  = 0;
+  while (( count = flz_parse(from, in, length, &ip, &produced,
+                             maxscratch - FASTLZ_WORKSPACE_SIZE, seq, 64))
+         > 0)
+    {
+      for (i = 0; i < count; i++)
+        {
+          const fastlz_sequence * s      = &seq[i];
+          uint32_t                start;
+
+          if (s->literal_length > 0)
+            {
+              fastlz_memcpy(data + pos, in + s->literal, s->literal_length);
+              pos += s->literal_length;
+            }
+
+          start = pos;
+          if (s->match_length == 0)
+            {
+              continue;
+            }
+
+          fastlz_memmove(data + pos, data + pos - s->distance,
+                         s->match_length);
+          pos += s->match_length;
+          if (level == 1 && s->distance > MAX_L1_DISTANCE)
+            {
+              continue;
+            }
+
+          if (start == anchor && s->distance == match_distance && level == 2)
+            {
+              match_len  += s->match_length;
+              anchor      = pos;
+              continue;
+            }
+
+          op = flz_transcode_match(level, match_len, match_distance, &anchor,
+                                   op);
+          if (start > anchor)
+            {
+              op = flz_transcode_literals(level, data, anchor, start, 0, htab,
+                                          op);
+            }
+
+          match_len       = s->match_length;
+          match_distance  = s->distance;
+          anchor          = pos;
+
+          /* Update the hash at match boundary, as the compressor does */
+          {
+            uint32_t v = flz_readu32(data + pos - 4);
+
+            htab[flz_hash(v & 0xffffff)]  = pos - 4;
+            htab[flz_hash(v >> 8)]        = pos - 3;
+          }
+        }
+    }
+
+  if (count < 0)
+    {
+      return count;
+    }
+
+  /*
+   * End with a literal run, as the compressors do: the decoder wants a byte
+   * after a far match. The last match gives up its last byte if needed.
+   */
+  if (match_len && anchor == pos)
+    {
+      if (match_len > 3)
+        {
+          match_len--;
+          anchor--;
+        }
+      else
+        {
+          anchor     -= match_len;
+          match_len   = 0;
+        }
+    }
+
+  op = flz_transcode_match(level, match_len, match_distance, &anchor, op);
+  op = flz_transcode_literals(level, data, anchor, pos, 1, htab, op);
+
+  /* Marker for fastlz2 */
+  if (level == 2)
+    {
+      *(uint8_t *)output |= ( 1 << 5 );
+    }
+
+  return op - (uint8_t *)output;
+}
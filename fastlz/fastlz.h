@@ -41,6 +41,22 @@
 
 # define FASTLZ_VERSION_STRING        "0.5.0"
 
+/*
+ * Upper bound of the compressed size of a block of the given length, valid
+ * for every compression level: one literal opcode per 32 bytes of input plus
+ * a small slack for the wide copies done by the compressor.
+ */
+
+# define FASTLZ_COMPRESS_BOUND(length) \
+  (( length ) + (( length ) >> 5 ) + 16 )
+
+/*
+ * Size in bytes of the scratch memory (the match finder hash table)
+ * needed by fastlz_compress_workspace.
+ */
+
+# define FASTLZ_WORKSPACE_SIZE        65536
+
 # if defined( __cplusplus )
   extern "C"
   {
@@ -53,8 +69,9 @@
  * compressed block. The size of input buffer is specified by length. The
  * minimum input buffer size is 16.
  *
- * The output buffer must be at least 5% larger than the input buffer
- * and can not be smaller than 66 bytes.
+ * The output buffer must be at least FASTLZ_COMPRESS_BOUND(length) bytes.
+ * Being 5% larger than the input buffer and not smaller than 66 bytes is
+ * always enough.
  *
  * If the input is not compressible, the return value might be larger than
  * length (input buffer size).
@@ -89,6 +106,44 @@
 int fastlz_compress_level(int level, const void *input, int length,
                           void *output);
 
+/*
+ * Compress data using caller-provided scratch memory
+ *
+ * Same as fastlz_compress_level, but the hash table used by the match finder
+ * lives in workspace instead of on the stack. The workspace must be at least
+ * FASTLZ_WORKSPACE_SIZE bytes, aligned for a 32-bit integer, and can be reused
+ * for any number of calls (but not concurrently). Its content does not need
+ * to be initialized and does not affect the compressed output.
+ *
+ * Parameters:
+ *
+ *                          level - compression level (1 or 2)
+ *                          input - data to compress
+ *                         length - length of input
+ *                         output - receives compressed data
+ *                      workspace - FASTLZ_WORKSPACE_SIZE bytes of scratch
+ *
+ * Returns: see fastlz_compress_level
+ */
+
+int fastlz_compress_workspace(int level, const void *input, int length,
+                              void *output, void *workspace);
+
+/*
+ * Maximum compressed size
+ *
+ * Returns the largest possible size of the compressed block for an input of
+ * the given length, i.e. FASTLZ_COMPRESS_BOUND(length). An output buffer of
+ * that size is always large enough for fastlz_compress_level.
+ *
+ * Returns:
+ *
+ *                            > 0 - compress bound
+ *         FASTLZ_ERROR_TOO_SMALL - length is negative
+ */
+
+int fastlz_compress_bound(int length);
+
 /*
  * Decompress data
  *
@@ -124,6 +179,106 @@ int fastlz_compress_level(int level, const void *input, int length,
 int fastlz_decompress(const void *input, int length, void *output,
                       int maxout);
 
+/*
+ * One step of a compressed block: a run of literal_length bytes stored at
+ * offset literal of the block, followed by match_length bytes repeated from
+ * distance bytes back in the decompressed data (1 is the previous byte).
+ * Either length can be zero. Every sequence corresponds to at most one
+ * literal run instruction and one match instruction of the block.
+ */
+
+typedef struct fastlz_sequence
+{
+  unsigned int  literal;
+  unsigned int  literal_length;
+  unsigned int  match_length;
+  unsigned int  distance;
+} fastlz_sequence;
+
+/*
+ * Position of fastlz_parse in a block. Set all fields to zero before the
+ * first call. After that, level is the compression level of the block and
+ * output is the decompressed size of the sequences returned so far.
+ */
+
+typedef struct fastlz_parser
+{
+  int           level;
+  unsigned int  position;
+  unsigned int  output;
+} fastlz_parser;
+
+/*
+ * Parse a compressed block into sequences
+ *
+ * Decodes up to count sequences of the block, continuing where the previous
+ * call with the same parser stopped, without decompressing anything. The
+ * sequences are validated like fastlz_decompress does: literal runs are
+ * inside the block, matches do not reach before its start, and a level 2
+ * match with a 16-bit distance does not end the block.
+ *
+ * Parameters:
+ *
+ *                         parser - parse position, zeroed initially
+ *                          input - compressed block
+ *                         length - length of input in bytes
+ *                            seq - receive the sequences
+ *                          count - size of seq
+ *
+ * Returns the number of sequences, 0 at the end of the block, or:
+ *
+ *           FASTLZ_ERROR_CORRUPT - input is corrupt
+ *         FASTLZ_ERROR_TOO_SMALL - length or count is out of range
+ *     FASTLZ_ERROR_UNKNOWN_LEVEL - not a known compression level
+ */
+
+int fastlz_parse(fastlz_parser *parser, const void *input, int length,
+                 fastlz_sequence *seq, int count);
+
+/*
+ * Convert a compressed block to another compression level
+ *
+ * Re-encodes the sequences of a level 1 block as level 2 or the other way
+ * round. From level 1, the pieces of long matches are joined and the literal
+ * runs are searched for the longer distances level 2 can reach. From level 2,
+ * matches farther than level 1 can reach become literals, which are searched
+ * again for nearer matches. A block already at the requested level is
+ * copied.
+ *
+ * Only the literal runs are searched, so this is just 1.2 to 1.5 times as
+ * fast as decompressing and compressing again, and the block is larger than
+ * a new compression at that level: by a few percent going to level 1, and
+ * by about 10% going to level 2 (more for large blocks), since the matches
+ * of level 1 are kept instead of looking for longer ones. "6pack -mem"
+ * measures both on a given file.
+ *
+ * The output buffer must be at least FASTLZ_COMPRESS_BOUND of the
+ * decompressed size. The scratch memory holds the match finder and the
+ * decompressed block: it must be FASTLZ_TRANSCODE_SCRATCH_SIZE of the
+ * decompressed size, aligned for a 32-bit integer.
+ *
+ * Parameters:
+ *
+ *                          level - new compression level (1 or 2)
+ *                          input - compressed block
+ *                         length - length of input in bytes
+ *                         output - receives the converted block
+ *                        scratch - working memory
+ *                     maxscratch - size of scratch in bytes
+ *
+ * Returns the size of the converted block, or:
+ *
+ *           FASTLZ_ERROR_CORRUPT - input is corrupt
+ *         FASTLZ_ERROR_TOO_SMALL - scratch is too small
+ *     FASTLZ_ERROR_UNKNOWN_LEVEL - level or input level not one or two
+ */
+
+# define FASTLZ_TRANSCODE_SCRATCH_SIZE(length) \
+  ( FASTLZ_WORKSPACE_SIZE + ( length ))
+
+int fastlz_transcode(int level, const void *input, int length, void *output,
+                     void *scratch, int maxscratch);
+
 # if defined( __cplusplus )
   }
 # endif /* if defined( __cplusplus ) */
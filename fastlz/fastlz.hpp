@@ -0,0 +1,300 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * FastLZ - Byte-aligned LZ77 compression library
+ *
+ * Copyright (c) 2005-2020 Ariya Hidayat <ariya.hidayat@gmail.com>
+ * Copyright (c) 2023 Jeffrey H. Johnson <trnsz@pobox.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ *  * The above copyright notice and this permission notice shall be
+ *    included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * C++17/20 interface over fastlz.h
+ *
+ * Header only; link with fastlz.c as usual. All functions report errors the
+ * same way as the C API (a negative FASTLZ_ERROR_* value) and never allocate,
+ * except fastlz::buffer when it has to grow. Keeping one context and one
+ * buffer per thread gives zero heap allocations per message once the buffer
+ * reached the size of the largest message.
+ */
+
+#ifndef FASTLZ_HPP
+# define FASTLZ_HPP
+
+# include "fastlz.h"
+
+# include <climits>
+# include <cstddef>
+# include <cstdint>
+# include <cstring>
+# include <memory>
+# include <utility>
+
+# if __cplusplus >= 202002L && defined( __has_include )
+#  if __has_include(<span>)
+#   include <span>
+#   define FASTLZ_HAVE_STD_SPAN
+#  endif /* if __has_include(<span>) */
+# endif /* if __cplusplus >= 202002L && defined( __has_include ) */
+
+namespace fastlz
+{
+
+# if defined( FASTLZ_HAVE_STD_SPAN )
+
+  using byte_view  = std::span<const std::byte>;
+  using byte_span  = std::span<std::byte>;
+
+# else  /* if defined( FASTLZ_HAVE_STD_SPAN ) */
+
+  /* Minimal stand-in for std::span in C++17 */
+  template <typename T>
+  class basic_span
+  {
+  public:
+    constexpr basic_span() noexcept : data_(nullptr), size_(0) { }
+
+    constexpr basic_span(T *data, std::size_t size) noexcept
+      : data_(data), size_(size) { }
+
+    template <typename U>
+    constexpr basic_span(const basic_span<U> &other) noexcept
+      : data_(other.data()), size_(other.size()) { }
+
+    constexpr T *data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+
+    constexpr basic_span first(std::size_t count) const noexcept
+    {
+      return basic_span(data_, count);
+    }
+
+    constexpr basic_span subspan(std::size_t offset) const noexcept
+    {
+      return basic_span(data_ + offset, size_ - offset);
+    }
+
+  private:
+    T *          data_;
+    std::size_t  size_;
+  };
+
+  using byte_view  = basic_span<const std::byte>;
+  using byte_span  = basic_span<std::byte>;
+
+# endif /* if defined( FASTLZ_HAVE_STD_SPAN ) */
+
+  /* Same as FASTLZ_COMPRESS_BOUND */
+  constexpr std::size_t
+  compress_bound(std::size_t length) noexcept
+  {
+    return length + ( length >> 5 ) + 16;
+  }
+
+  /*
+   * Caller-owned, reusable output storage.
+   *
+   * Move-only. The capacity only ever grows, so a buffer kept across calls
+   * stops allocating once it has seen the largest message. The content is
+   * left uninitialized when growing.
+   */
+
+  class buffer
+  {
+  public:
+    buffer() noexcept : size_(0), capacity_(0) { }
+
+    explicit buffer(std::size_t capacity) : buffer() { reserve(capacity); }
+
+    buffer(buffer &&other) noexcept
+      : data_(std::move(other.data_)),
+        size_(std::exchange(other.size_, 0)),
+        capacity_(std::exchange(other.capacity_, 0)) { }
+
+    buffer &
+    operator=(buffer &&other) noexcept
+    {
+      data_      = std::move(other.data_);
+      size_      = std::exchange(other.size_, 0);
+      capacity_  = std::exchange(other.capacity_, 0);
+      return *this;
+    }
+
+    buffer(const buffer &) = delete;
+    buffer &operator=(const buffer &) = delete;
+
+    void
+    reserve(std::size_t capacity)
+    {
+      if (capacity > capacity_)
+        {
+          std::unique_ptr<std::byte[]> grown(new std::byte[capacity]);
+          if (size_)
+            {
+              std::memcpy(grown.get(), data_.get(), size_);
+            }
+
+          data_      = std::move(grown);
+          capacity_  = capacity;
+        }
+    }
+
+    /* Shrinking or growing within the capacity never allocates */
+    void
+    resize(std::size_t size)
+    {
+      reserve(size);
+      size_ = size;
+    }
+
+    void clear() noexcept { size_ = 0; }
+
+    std::byte *data() noexcept { return data_.get(); }
+    const std::byte *data() const noexcept { return data_.get(); }
+    std::size_t size() const noexcept { return size_; }
+    std::size_t capacity() const noexcept { return capacity_; }
+
+    byte_view view() const noexcept { return byte_view(data_.get(), size_); }
+
+    /* The whole capacity, for writing into */
+    byte_span
+    storage() noexcept
+    {
+      return byte_span(data_.get(), capacity_);
+    }
+
+  private:
+    std::unique_ptr<std::byte[]>  data_;
+    std::size_t                   size_;
+    std::size_t                   capacity_;
+  };
+
+  /*
+   * Reusable compression state: the level and the match finder workspace
+   * (FASTLZ_WORKSPACE_SIZE bytes, allocated once). Not thread-safe; use one
+   * context per thread.
+   */
+
+  class context
+  {
+  public:
+    explicit context(int level = 1)
+      : level_(level),
+        workspace_(new std::uint32_t[FASTLZ_WORKSPACE_SIZE
+                                     / sizeof( std::uint32_t )]) { }
+
+    context(context &&) noexcept = default;
+    context &operator=(context &&) noexcept = default;
+    context(const context &) = delete;
+    context &operator=(const context &) = delete;
+
+    int level() const noexcept { return level_; }
+    void set_level(int level) noexcept { level_ = level; }
+
+    void *workspace() const noexcept { return workspace_.get(); }
+
+  private:
+    int                               level_;
+    std::unique_ptr<std::uint32_t[]>  workspace_;
+  };
+
+  /*
+   * Compress input into output, which must hold compress_bound(input.size())
+   * bytes. Returns the compressed size or a negative FASTLZ_ERROR_* value.
+   */
+
+  inline int
+  compress(context &ctx, byte_view input, byte_span output) noexcept
+  {
+    if (input.size() > INT_MAX / 2)
+      {
+        return FASTLZ_ERROR_CORRUPT;
+      }
+
+    if (output.size() < compress_bound(input.size()))
+      {
+        return FASTLZ_ERROR_TOO_SMALL;
+      }
+
+    return fastlz_compress_workspace(ctx.level(), input.data(),
+                                     (int)input.size(), output.data(),
+                                     ctx.workspace());
+  }
+
+  /*
+   * Compress input, replacing the content of output. The buffer grows to the
+   * compress bound if needed and is then resized to the compressed size.
+   */
+
+  inline int
+  compress(context &ctx, byte_view input, buffer &output)
+  {
+    output.reserve(compress_bound(input.size()));
+
+    int result = compress(ctx, input, output.storage());
+    output.resize(result > 0 ? (std::size_t)result : 0);
+
+    return result;
+  }
+
+  /*
+   * Decompress input into output. Returns the decompressed size or a
+   * negative FASTLZ_ERROR_* value.
+   */
+
+  inline int
+  decompress(byte_view input, byte_span output) noexcept
+  {
+    if (input.empty())
+      {
+        return FASTLZ_ERROR_TOO_SMALL;
+      }
+
+    if (input.size() > INT_MAX || output.size() > INT_MAX)
+      {
+        return FASTLZ_ERROR_CORRUPT;
+      }
+
+    return fastlz_decompress(input.data(), (int)input.size(), output.data(),
+                             (int)output.size());
+  }
+
+  /*
+   * Decompress input, replacing the content of output. The decompressed
+   * size is not stored in a FastLZ block, so it has to be known by the
+   * caller (e.g. sent alongside the block).
+   */
+
+  inline int
+  decompress(byte_view input, buffer &output, std::size_t decompressed_size)
+  {
+    output.reserve(decompressed_size);
+
+    int result = decompress(input, output.storage().first(decompressed_size));
+    output.resize(result > 0 ? (std::size_t)result : 0);
+
+    return result;
+  }
+
+} /* namespace fastlz */
+
+#endif /* FASTLZ_HPP */
@@ -0,0 +1,553 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * FastLZ - Byte-aligned LZ77 compression library
+ *
+ * Copyright (c) 2005-2020 Ariya Hidayat <ariya.hidayat@gmail.com>
+ * Copyright (c) 2023 Jeffrey H. Johnson <trnsz@pobox.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ *  * The above copyright notice and this permission notice shall be
+ *    included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * C++20 coroutine interface for compressing between file descriptors
+ *
+ * POSIX only. fastlz::async_compress reads fd_in, compresses it block by
+ * block and writes the stream (same layout as fastlz::ostreambuf) to fd_out.
+ * Whenever a descriptor would block, the coroutine suspends and asks the
+ * scheduler to resume it once the descriptor is ready, so the thread running
+ * the event loop never blocks. Blocks larger than offload_threshold are
+ * compressed on the scheduler's worker threads if it has any.
+ *
+ * Event loops plug in by implementing fastlz::scheduler; a small poll(2)
+ * based one is provided:
+ *
+ *   fastlz::poll_scheduler loop(2);
+ *   auto job = fastlz::async_compress(loop, fd_in, fd_out);
+ *   job.start();
+ *   loop.run();
+ *   long long written = job.result();
+ */
+
+#ifndef FASTLZ_ASYNC_HPP
+# define FASTLZ_ASYNC_HPP
+
+# include "fastlz_stream.hpp"
+
+# include <cerrno>
+# include <condition_variable>
+# include <coroutine>
+# include <deque>
+# include <exception>
+# include <functional>
+# include <mutex>
+# include <system_error>
+# include <thread>
+# include <vector>
+
+# include <fcntl.h>
+# include <poll.h>
+# include <unistd.h>
+
+namespace fastlz
+{
+
+  /*
+   * Lazily started coroutine producing a T. Awaiting it starts it; a
+   * top-level task is started with start() and its value read with
+   * result() once done().
+   */
+
+  template <typename T>
+  class task
+  {
+  public:
+    struct promise_type
+    {
+      T                        value{};
+      std::exception_ptr       error;
+      std::coroutine_handle<>  continuation;
+
+      task
+      get_return_object()
+      {
+        return task(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+
+      std::suspend_always initial_suspend() noexcept { return {}; }
+
+      struct final_awaiter
+      {
+        bool await_ready() noexcept { return false; }
+
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          if (h.promise().continuation)
+            {
+              return h.promise().continuation;
+            }
+
+          return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept { }
+      };
+
+      final_awaiter final_suspend() noexcept { return {}; }
+
+      void return_value(T v) { value = std::move(v); }
+
+      void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    task(task &&other) noexcept : handle_(std::exchange(other.handle_, {})) { }
+
+    task &
+    operator=(task &&other) noexcept
+    {
+      if (handle_)
+        {
+          handle_.destroy();
+        }
+
+      handle_ = std::exchange(other.handle_, {});
+      return *this;
+    }
+
+    ~task()
+    {
+      if (handle_)
+        {
+          handle_.destroy();
+        }
+    }
+
+    void start() { handle_.resume(); }
+
+    bool done() const noexcept { return handle_.done(); }
+
+    T
+    result()
+    {
+      if (handle_.promise().error)
+        {
+          std::rethrow_exception(handle_.promise().error);
+        }
+
+      return std::move(handle_.promise().value);
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+      handle_.promise().continuation = caller;
+      return handle_;
+    }
+
+    T await_resume() { return result(); }
+
+  private:
+    explicit task(std::coroutine_handle<promise_type> h) : handle_(h) { }
+
+    std::coroutine_handle<promise_type> handle_;
+  };
+
+  /*
+   * Event loop integration. wait() must resume h on the loop thread once fd
+   * is ready for events (POLLIN or POLLOUT). offload() may run work on
+   * another thread, then must resume h on the loop thread; schedulers
+   * without workers return false from can_offload() and the work is done
+   * inline.
+   */
+
+  class scheduler
+  {
+  public:
+    virtual ~scheduler() = default;
+
+    virtual void wait(int fd, short events, std::coroutine_handle<> h) = 0;
+
+    virtual bool can_offload() const { return false; }
+
+    virtual void
+    offload(std::function<void()> work, std::coroutine_handle<> h)
+    {
+      work();
+      h.resume();
+    }
+  };
+
+  namespace detail
+  {
+
+    struct fd_awaiter
+    {
+      scheduler &  sched;
+      int          fd;
+      short        events;
+
+      bool await_ready() const noexcept { return false; }
+
+      void
+      await_suspend(std::coroutine_handle<> h)
+      {
+        sched.wait(fd, events, h);
+      }
+
+      void await_resume() const noexcept { }
+    };
+
+    struct offload_awaiter
+    {
+      scheduler &                    sched;
+      const std::function<void()> &  work;
+
+      bool
+      await_ready()
+      {
+        if (sched.can_offload())
+          {
+            return false;
+          }
+
+        work();
+        return true;
+      }
+
+      void
+      await_suspend(std::coroutine_handle<> h)
+      {
+        sched.offload(work, h);
+      }
+
+      void await_resume() const noexcept { }
+    };
+
+    /* Write everything, suspending while fd is full; 0 or -errno */
+    inline task<int>
+    write_all(scheduler &sched, int fd, const unsigned char *data,
+              std::size_t size)
+    {
+      while (size > 0)
+        {
+          ssize_t n = ::write(fd, data, size);
+          if (n > 0)
+            {
+              data  += n;
+              size  -= n;
+            }
+          else if (n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ))
+            {
+              co_await fd_awaiter{ sched, fd, POLLOUT };
+            }
+          else if (n < 0 && errno == EINTR)
+            {
+              continue;
+            }
+          else
+            {
+              co_return n < 0 ? -errno : -EIO;
+            }
+        }
+
+      co_return 0;
+    }
+
+  } /* namespace detail */
+
+  struct async_options
+  {
+    int          level              = 1;
+    std::size_t  block_size         = 65536;
+    std::size_t  offload_threshold  = 16384;
+  };
+
+  /*
+   * Compress everything readable from fd_in until end of file into fd_out.
+   * Both descriptors should be non-blocking. Returns the number of bytes
+   * written, or a negative errno value on failure.
+   */
+
+  inline task<long long>
+  async_compress(scheduler &sched, int fd_in, int fd_out,
+                 async_options options = {})
+  {
+    context    ctx(options.level);
+    buffer     block(options.block_size);
+    buffer     chunk(16 + compress_bound(options.block_size));
+    long long  total = 0;
+    int        status;
+
+    status = co_await detail::write_all(sched, fd_out, detail::sixpack_magic,
+                                        8);
+    if (status < 0)
+      {
+        co_return status;
+      }
+
+    total += 8;
+
+    for (bool eof = false; !eof;)
+      {
+        std::size_t size = 0;
+
+        /* Fill a whole block, or whatever is left before end of file */
+        while (size < options.block_size)
+          {
+            ssize_t n = ::read(fd_in, block.data() + size,
+                               options.block_size - size);
+            if (n > 0)
+              {
+                size += n;
+              }
+            else if (n == 0)
+              {
+                eof = true;
+                break;
+              }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+              {
+                co_await detail::fd_awaiter{ sched, fd_in, POLLIN };
+              }
+            else if (errno != EINTR)
+              {
+                co_return -errno;
+              }
+          }
+
+        if (size == 0)
+          {
+            break;
+          }
+
+        std::size_t            length  = 0;
+        std::function<void()>  encode  = [&] {
+            length = detail::encode_chunk(ctx, block.data(), size,
+                                          (unsigned char *)chunk.data());
+          };
+
+        if (size >= options.offload_threshold)
+          {
+            co_await detail::offload_awaiter{ sched, encode };
+          }
+        else
+          {
+            encode();
+          }
+
+        status = co_await detail::write_all(sched, fd_out,
+                                            (unsigned char *)chunk.data(),
+                                            length);
+        if (status < 0)
+          {
+            co_return status;
+          }
+
+        total += length;
+      }
+
+    co_return total;
+  }
+
+  /*
+   * Minimal poll(2) based scheduler. run() dispatches until nothing is
+   * waiting anymore. With workers > 0, offloaded work runs on that many
+   * threads and the coroutines are resumed back on the thread calling run().
+   */
+
+  class poll_scheduler : public scheduler
+  {
+  public:
+    explicit poll_scheduler(unsigned workers = 0) : in_flight_(0), stop_(false)
+    {
+      if (::pipe(wakeup_) != 0)
+        {
+          throw std::system_error(errno, std::generic_category());
+        }
+
+      ::fcntl(wakeup_[0], F_SETFL, O_NONBLOCK);
+      for (unsigned i = 0; i < workers; ++i)
+        {
+          threads_.emplace_back([this] { work_loop(); });
+        }
+    }
+
+    ~poll_scheduler() override
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      cond_.notify_all();
+      for (auto &t : threads_)
+        {
+          t.join();
+        }
+
+      ::close(wakeup_[0]);
+      ::close(wakeup_[1]);
+    }
+
+    void
+    wait(int fd, short events, std::coroutine_handle<> h) override
+    {
+      waits_.push_back({ fd, events, h });
+    }
+
+    bool can_offload() const override { return !threads_.empty(); }
+
+    void
+    offload(std::function<void()> work, std::coroutine_handle<> h) override
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back({ std::move(work), h });
+      }
+      ++in_flight_;
+      cond_.notify_one();
+    }
+
+    void
+    run()
+    {
+      std::vector<pollfd> fds;
+
+      while (!waits_.empty() || in_flight_ > 0)
+        {
+          fds.clear();
+          fds.push_back({ wakeup_[0], POLLIN, 0 });
+          for (const auto &w : waits_)
+            {
+              fds.push_back({ w.fd, w.events, 0 });
+            }
+
+          if (::poll(fds.data(), fds.size(), -1) < 0)
+            {
+              if (errno == EINTR)
+                {
+                  continue;
+                }
+
+              throw std::system_error(errno, std::generic_category());
+            }
+
+          /* Resuming may register new waits, so detach the ready ones first */
+          std::vector<std::coroutine_handle<>> ready;
+          std::vector<waiter> pending;
+          for (std::size_t i = 0; i < waits_.size(); ++i)
+            {
+              if (fds[i + 1].revents)
+                {
+                  ready.push_back(waits_[i].handle);
+                }
+              else
+                {
+                  pending.push_back(waits_[i]);
+                }
+            }
+
+          waits_.swap(pending);
+
+          if (fds[0].revents)
+            {
+              char drain[64];
+              while (::read(wakeup_[0], drain, sizeof( drain )) > 0)
+                {
+                }
+
+              std::lock_guard<std::mutex> lock(mutex_);
+              for (auto h : done_)
+                {
+                  ready.push_back(h);
+                  --in_flight_;
+                }
+
+              done_.clear();
+            }
+
+          for (auto h : ready)
+            {
+              h.resume();
+            }
+        }
+    }
+
+  private:
+    struct waiter
+    {
+      int                      fd;
+      short                    events;
+      std::coroutine_handle<>  handle;
+    };
+
+    struct job
+    {
+      std::function<void()>    work;
+      std::coroutine_handle<>  handle;
+    };
+
+    void
+    work_loop()
+    {
+      for (;;)
+        {
+          job j;
+          {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+            if (jobs_.empty())
+              {
+                return;
+              }
+
+            j = std::move(jobs_.front());
+            jobs_.pop_front();
+          }
+
+          j.work();
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_.push_back(j.handle);
+          }
+
+          char c = 0;
+          while (::write(wakeup_[1], &c, 1) < 0 && errno == EINTR)
+            {
+            }
+        }
+    }
+
+    int                                   wakeup_[2];
+    std::vector<waiter>                   waits_;
+    std::size_t                           in_flight_;
+    bool                                  stop_;
+    std::mutex                            mutex_;
+    std::condition_variable               cond_;
+    std::deque<job>                       jobs_;
+    std::vector<std::coroutine_handle<>>  done_;
+    std::vector<std::thread>              threads_;
+  };
+
+} /* namespace fastlz */
+
+#endif /* FASTLZ_ASYNC_HPP */
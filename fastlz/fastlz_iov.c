@@ -0,0 +1,1033 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * FastLZ - Byte-aligned LZ77 compression library
+ *
+ * Copyright (c) 2005-2020 Ariya Hidayat <ariya.hidayat@gmail.com>
+ * Copyright (c) 2023 Jeffrey H. Johnson <trnsz@pobox.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ *  * The above copyright notice and this permission notice shall be
+ *    included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "fastlz.h"
+#include "fastlz_iov.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * The block format and the match finder are the same as in fastlz.c, but
+ * positions are logical offsets into the concatenation of the buffers, and
+ * every access goes through a cursor that maps them back to memory. Reads
+ * that fit inside one buffer take the direct path.
+ */
+
+#define MAX_COPY          32
+#define MAX_LEN           264  /* 256 + 8 */
+#define MAX_L1_DISTANCE   8192
+#define MAX_L2_DISTANCE   8191
+#define MAX_FARDISTANCE   ( 65535 + MAX_L2_DISTANCE - 1 )
+
+#if defined( __BYTE_ORDER__ ) && defined( __ORDER_LITTLE_ENDIAN__ )
+# if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#  define FLZ_LITTLE_ENDIAN
+# endif /* if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ */
+#elif defined( __x86_64__ ) || defined( _M_X64 ) || defined( __i386__ ) \
+  || defined( _M_IX86 ) || defined( _M_ARM64 )
+# define FLZ_LITTLE_ENDIAN
+#endif /* if defined( __BYTE_ORDER__ ) && defined( __ORDER_LITTLE_ENDIAN__ ) */
+
+#define HASH_LOG          14
+#define HASH_SIZE         ( 1 << HASH_LOG )
+#define HASH_MASK         ( HASH_SIZE - 1 )
+
+/* Random access into a list of buffers */
+typedef struct flz_cursor
+{
+  const struct iovec *  iov;
+  int                   cnt;
+  int                   idx;
+  uint32_t              start;  /* logical offset of iov[idx] */
+  uint32_t              end;    /* logical offset past iov[idx] */
+  uint8_t *             base;   /* memory at logical offset start */
+} flz_cursor;
+
+/* Sequential output into a list of buffers */
+typedef struct flz_writer
+{
+  const struct iovec *  iov;
+  int                   cnt;
+  int                   idx;
+  uint8_t *             op;
+  uint8_t *             op_start;
+  uint8_t *             op_end;
+  uint32_t              done;   /* bytes written before iov[idx] */
+  uint8_t *             first;
+} flz_writer;
+
+#define FLZ_ROOM(w)       ((size_t)(( w )->op_end - ( w )->op ))
+#define FLZ_TOTAL(w)      (( w )->done + (uint32_t)(( w )->op - ( w )->op_start ))
+
+static void
+flz_cursor_init(flz_cursor *c, const struct iovec *iov, int cnt)
+{
+  c->iov    = iov;
+  c->cnt    = cnt;
+  c->idx    = 0;
+  c->start  = 0;
+  c->end    = (uint32_t)iov[0].iov_len;
+  c->base   = (uint8_t *)iov[0].iov_base;
+}
+
+/* Locate pos, which must be inside the buffers */
+static uint8_t *
+flz_seek(flz_cursor *c, uint32_t pos, uint32_t *avail)
+{
+  if (pos - c->start >= c->end - c->start)
+    {
+      while (pos < c->start)
+        {
+          c->idx--;
+          c->start -= (uint32_t)c->iov[c->idx].iov_len;
+        }
+
+      while (pos - c->start >= (uint32_t)c->iov[c->idx].iov_len)
+        {
+          c->start += (uint32_t)c->iov[c->idx].iov_len;
+          c->idx++;
+        }
+
+      c->end   = c->start + (uint32_t)c->iov[c->idx].iov_len;
+      c->base  = (uint8_t *)c->iov[c->idx].iov_base;
+    }
+
+  *avail = c->end - pos;
+  return c->base + ( pos - c->start );
+}
+
+static uint32_t
+flz_load32(const uint8_t *p)
+{
+#if defined( FLZ_LITTLE_ENDIAN )
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+#else  /* if defined( FLZ_LITTLE_ENDIAN ) */
+    return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ((uint32_t)p[3] << 24 );
+#endif /* if defined( FLZ_LITTLE_ENDIAN ) */
+}
+
+/* Little-endian read of 4 bytes at pos, which may straddle buffers */
+static uint32_t
+flz_readu32_split(flz_cursor *c, uint32_t pos)
+{
+  const uint8_t * p;
+  uint32_t        avail;
+  uint32_t        v = 0;
+  int             i;
+
+  for (i = 0; i < 4; i++)
+    {
+      p   = flz_seek(c, pos + i, &avail);
+      v  |= (uint32_t)*p << ( 8 * i );
+    }
+
+  return v;
+}
+
+#define flz_readu32(c, pos)                                        \
+  ((pos) - ( c )->start + 4 <= ( c )->end - ( c )->start           \
+    && (pos) >= ( c )->start                                       \
+      ? flz_load32(( c )->base + ((pos) - ( c )->start ))          \
+      : flz_readu32_split(c, pos))
+
+/* Number of equal bytes at p and q, q never reaching r */
+static uint32_t
+flz_cmp(flz_cursor *cp, uint32_t p, flz_cursor *cq, uint32_t q, uint32_t r)
+{
+  uint32_t start = q;
+
+  while (q < r)
+    {
+      uint32_t        ap, aq, n, i;
+      const uint8_t * x  = flz_seek(cp, p, &ap);
+      const uint8_t * y  = flz_seek(cq, q, &aq);
+
+      n  = r - q;
+      n  = ap < n ? ap : n;
+      n  = aq < n ? aq : n;
+      i  = 0;
+      while (i + 8 <= n && flz_load32(x + i) == flz_load32(y + i)
+             && flz_load32(x + i + 4) == flz_load32(y + i + 4))
+        {
+          i += 8;
+        }
+
+      for (; i < n; i++)
+        {
+          if (x[i] != y[i])
+            {
+              return q + i - start;
+            }
+        }
+
+      p  += n;
+      q  += n;
+    }
+
+  return q - start;
+}
+
+static uint16_t
+flz_hash(uint32_t v)
+{
+  uint32_t h = ( v * 2654435769UL ) >> ( 32 - HASH_LOG );
+
+  return h & HASH_MASK;
+}
+
+static void
+flz_writer_init(flz_writer *w, const struct iovec *iov, int cnt)
+{
+  memset(w, 0, sizeof( *w ));
+  w->iov  = iov;
+  w->cnt  = cnt;
+  w->idx  = -1;
+}
+
+static int
+flz_put(flz_writer *w, const uint8_t *src, uint32_t count)
+{
+  /* Fits in the current buffer */
+  if (FLZ_ROOM(w) >= count)
+    {
+      memcpy(w->op, src, count);
+      w->op += count;
+      return 0;
+    }
+
+  while (count > 0)
+    {
+      size_t room = FLZ_ROOM(w);
+
+      if (room == 0)
+        {
+          w->done += (uint32_t)( w->op - w->op_start );
+          if (++w->idx >= w->cnt)
+            {
+              return FASTLZ_ERROR_TOO_SMALL;
+            }
+
+          w->op        = (uint8_t *)w->iov[w->idx].iov_base;
+          w->op_start  = w->op;
+          w->op_end    = w->op + w->iov[w->idx].iov_len;
+          continue;
+        }
+
+      if (!w->first)
+        {
+          w->first = w->op;
+        }
+
+      room = room < count ? room : count;
+      memcpy(w->op, src, room);
+      w->op  += room;
+      src    += room;
+      count  -= room;
+    }
+
+  return 0;
+}
+
+static int
+flz_literals(flz_writer *w, flz_cursor *c, uint32_t pos, uint32_t runs)
+{
+  /* Contiguous source and enough room: same as fastlz.c */
+  if (pos >= c->start && pos + runs <= c->end
+      && FLZ_ROOM(w) >= runs + runs / MAX_COPY + 1)
+    {
+      const uint8_t * src  = c->base + ( pos - c->start );
+      uint8_t *       op   = w->op;
+
+      while (runs > 0)
+        {
+          uint32_t count = runs < MAX_COPY ? runs : MAX_COPY;
+
+          *op++  = count - 1;
+          memcpy(op, src, count);
+          op    += count;
+          src   += count;
+          runs  -= count;
+        }
+
+      w->op = op;
+      return 0;
+    }
+
+  while (runs > 0)
+    {
+      uint32_t  count  = runs < MAX_COPY ? runs : MAX_COPY;
+      uint8_t   code   = count - 1;
+
+      if (flz_put(w, &code, 1) < 0)
+        {
+          return FASTLZ_ERROR_TOO_SMALL;
+        }
+
+      runs -= count;
+      while (count > 0)
+        {
+          uint32_t        avail;
+          const uint8_t * p = flz_seek(c, pos, &avail);
+
+          avail = avail < count ? avail : count;
+          if (flz_put(w, p, avail) < 0)
+            {
+              return FASTLZ_ERROR_TOO_SMALL;
+            }
+
+          pos    += avail;
+          count  -= avail;
+        }
+    }
+
+  return 0;
+}
+
+static int
+flz1_match(flz_writer *w, uint32_t len, uint32_t distance)
+{
+  uint8_t  code[3];
+  int      n;
+
+  --distance;
+  while (len > MAX_LEN - 2)
+    {
+      code[0]  = ( 7 << 5 ) + ( distance >> 8 );
+      code[1]  = MAX_LEN - 2 - 7 - 2;
+      code[2]  = ( distance & 255 );
+      if (flz_put(w, code, 3) < 0)
+        {
+          return FASTLZ_ERROR_TOO_SMALL;
+        }
+
+      len -= MAX_LEN - 2;
+    }
+
+  if (len < 7)
+    {
+      code[0]  = ( len << 5 ) + ( distance >> 8 );
+      code[1]  = ( distance & 255 );
+      n        = 2;
+    }
+  else
+    {
+      code[0]  = ( 7 << 5 ) + ( distance >> 8 );
+      code[1]  = len - 7;
+      code[2]  = ( distance & 255 );
+      n        = 3;
+    }
+
+  if (FLZ_ROOM(w) >= 3)
+    {
+      w->op[0]  = code[0];
+      w->op[1]  = code[1];
+      if (n == 3)
+        {
+          w->op[2] = code[2];
+        }
+
+      w->op += n;
+      return 0;
+    }
+
+  return flz_put(w, code, n);
+}
+
+static int
+flz2_match(flz_writer *w, uint32_t len, uint32_t distance)
+{
+  uint8_t   code[24];
+  uint32_t  far;
+  int       n = 0;
+
+  --distance;
+  far = distance >= MAX_L2_DISTANCE;
+  if (far)
+    {
+      distance -= MAX_L2_DISTANCE;
+    }
+
+  if (len < 7)
+    {
+      code[n++] = ( len << 5 ) + ( far ? 31 : ( distance >> 8 ));
+    }
+  else
+    {
+      code[n++] = ( 7 << 5 ) + ( far ? 31 : ( distance >> 8 ));
+      for (len -= 7; len >= 255; len -= 255)
+        {
+          code[n++] = 255;
+          if (n == 16)
+            {
+              if (flz_put(w, code, n) < 0)
+                {
+                  return FASTLZ_ERROR_TOO_SMALL;
+                }
+
+              n = 0;
+            }
+        }
+
+      code[n++] = len;
+    }
+
+  if (far)
+    {
+      code[n++]  = 255;
+      code[n++]  = distance >> 8;
+    }
+
+  code[n++] = distance & 255;
+
+  return flz_put(w, code, n);
+}
+
+static int
+flz_compress_iov(int level, flz_cursor *in, uint32_t length,
+                 flz_writer *w, uint32_t *htab)
+{
+  flz_cursor  ref_cursor  = *in;
+  flz_cursor  lit_cursor  = *in;
+  uint32_t    ip          = 0;
+  uint32_t    anchor      = 0;
+  uint32_t    ip_bound    = length - 4; /* because readU32 */
+  uint32_t    ip_limit    = length - 12 - 1;
+  uint32_t    max_distance
+    = level == 1 ? MAX_L1_DISTANCE : MAX_FARDISTANCE;
+  uint32_t    seq, hash;
+
+  for (hash = 0; hash < HASH_SIZE; ++hash)
+    {
+      htab[hash] = 0;
+    }
+
+  /* Too short for any match */
+  if (length < 16)
+    {
+      ip_limit = 0;
+    }
+
+  ip += 2;
+  while (ip < ip_limit)
+    {
+      uint32_t  ref;
+      uint32_t  distance, cmp, len;
+
+      /* Find potential match */
+      do
+        {
+          seq         = flz_readu32(in, ip) & 0xffffff;
+          hash        = flz_hash(seq);
+          ref         = htab[hash];
+          htab[hash]  = ip;
+          distance    = ip - ref;
+          cmp         = distance < max_distance
+                          ? flz_readu32(&ref_cursor, ref) & 0xffffff
+                          : 0x1000000;
+          if (ip >= ip_limit)
+            {
+              break;
+            }
+
+          ++ip;
+        }
+      while (seq != cmp);
+
+      if (ip >= ip_limit)
+        {
+          break;
+        }
+
+      --ip;
+
+      /* Far, needs at least 5-byte match */
+      if (level == 2 && distance >= MAX_L2_DISTANCE)
+        {
+          if (( flz_readu32(&ref_cursor, ref + 1) >> 16 )
+              != ( flz_readu32(in, ip + 1) >> 16 ))
+            {
+              ++ip;
+              continue;
+            }
+        }
+
+      if (ip > anchor)
+        {
+          if (flz_literals(w, &lit_cursor, anchor, ip - anchor) < 0)
+            {
+              return FASTLZ_ERROR_TOO_SMALL;
+            }
+        }
+
+      /* Same length convention as flz_cmp in fastlz.c */
+      len = flz_cmp(&ref_cursor, ref + 3, in, ip + 3, ip_bound);
+      if (ip + 3 + len < ip_bound)
+        {
+          len++;
+        }
+
+      if (( level == 1 ? flz1_match(w, len, distance)
+                       : flz2_match(w, len, distance)) < 0)
+        {
+          return FASTLZ_ERROR_TOO_SMALL;
+        }
+
+      /* Update the hash at match boundary */
+      ip           += len;
+      seq           = flz_readu32(in, ip);
+      hash          = flz_hash(seq & 0xffffff);
+      htab[hash]    = ip++;
+      seq         >>= 8;
+      hash          = flz_hash(seq);
+      htab[hash]    = ip++;
+
+      anchor        = ip;
+    }
+
+  if (flz_literals(w, &lit_cursor, anchor, length - anchor) < 0)
+    {
+      return FASTLZ_ERROR_TOO_SMALL;
+    }
+
+  /* Marker for fastlz2 */
+  if (level == 2)
+    {
+      *w->first |= ( 1 << 5 );
+    }
+
+  return (int)FLZ_TOTAL(w);
+}
+
+static uint32_t
+flz_total(const struct iovec *iov, int cnt, int *overflow)
+{
+  uint64_t  total = 0;
+  int       i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      total += iov[i].iov_len;
+    }
+
+  *overflow = total > 0x7fffffff;
+  return (uint32_t)total;
+}
+
+int
+fastlz_compress_iov(int level, const struct iovec *iov, int iovcnt,
+                    const struct iovec *out, int outcnt, void *workspace)
+{
+  flz_cursor  in;
+  flz_writer  w;
+  uint32_t    length;
+  int         overflow;
+
+  if (level != 1 && level != 2)
+    {
+      return FASTLZ_ERROR_UNKNOWN_LEVEL;
+    }
+
+  length = flz_total(iov, iovcnt, &overflow);
+  if (overflow || length > 0x7c000000)
+    {
+      return FASTLZ_ERROR_CORRUPT;
+    }
+
+  /* Contiguous on both sides, nothing to map */
+  if (iovcnt == 1 && outcnt == 1
+      && out[0].iov_len >= (size_t)FASTLZ_COMPRESS_BOUND(length))
+    {
+      return fastlz_compress_workspace(level, iov[0].iov_base, length,
+                                       out[0].iov_base, workspace);
+    }
+
+  if (length == 0)
+    {
+      return FASTLZ_ERROR_TOO_SMALL;
+    }
+
+  flz_cursor_init(&in, iov, iovcnt);
+  flz_writer_init(&w, out, outcnt);
+
+  return flz_compress_iov(level, &in, length, &w, (uint32_t *)workspace);
+}
+
+int
+fastlz_compress_ring(int level, const void *ring, int capacity, int start,
+                     int length, void *output, void *workspace)
+{
+  struct iovec  iov[2];
+  struct iovec  out;
+  int           head;
+
+  if (capacity <= 0 || start < 0 || start >= capacity || length < 0
+      || length > capacity || length > 0x7c000000)
+    {
+      return FASTLZ_ERROR_CORRUPT;
+    }
+
+  /* From start to the end of the ring, then from the beginning */
+  head             = capacity - start < length ? capacity - start : length;
+  iov[0].iov_base  = (uint8_t *)ring + start;
+  iov[0].iov_len   = head;
+  iov[1].iov_base  = (void *)ring;
+  iov[1].iov_len   = length - head;
+  out.iov_base     = output;
+  out.iov_len      = FASTLZ_COMPRESS_BOUND(length);
+
+  return fastlz_compress_iov(level, iov, head < length ? 2 : 1, &out, 1,
+                             workspace);
+}
+
+/* Sequences parsed per call of fastlz_parse */
+#define FLZ_SEQ_BATCH     256
+
+/* Copy len bytes from distance back in the output, so overlaps repeat */
+static int
+flz_put_match(flz_writer *w, flz_cursor *c, uint32_t len, uint32_t distance)
+{
+  uint32_t ref = FLZ_TOTAL(w) - distance;
+
+  while (len > 0)
+    {
+      uint32_t        avail;
+      const uint8_t * p = flz_seek(c, ref, &avail);
+      uint32_t        n = FLZ_TOTAL(w) - ref;
+
+      n = avail < n ? avail : n;
+      n = len < n ? len : n;
+      if (flz_put(w, p, n) < 0)
+        {
+          return FASTLZ_ERROR_TOO_SMALL;
+        }
+
+      ref  += n;
+      len  -= n;
+    }
+
+  return 0;
+}
+
+/* A compressed block in one buffer: its sequences come from fastlz_parse */
+static int
+flz_decompress_parsed(const uint8_t *input, uint32_t length, flz_writer *w,
+                      flz_cursor *c, uint32_t maxout)
+{
+  fastlz_parser    parser;
+  fastlz_sequence  seq[FLZ_SEQ_BATCH];
+  int              count, i;
+
+  memset(&parser, 0, sizeof( parser ));
+  while (( count = fastlz_parse(&parser, input, (int)length, seq,
+                                FLZ_SEQ_BATCH)) > 0)
+    {
+      for (i = 0; i < count; i++)
+        {
+          const fastlz_sequence * s = &seq[i];
+
+          if (s->literal_length + s->match_length > maxout - FLZ_TOTAL(w)
+              || flz_put(w, input + s->literal, s->literal_length) < 0
+              || flz_put_match(w, c, s->match_length, s->distance) < 0)
+            {
+              return FASTLZ_ERROR_TOO_SMALL;
+            }
+        }
+    }
+
+  return count < 0 ? count : (int)FLZ_TOTAL(w);
+}
+
+/* Sequential input from a list of buffers */
+typedef struct flz_reader
+{
+  const struct iovec *  iov;
+  int                   cnt;
+  int                   idx;
+  size_t                off;
+  uint32_t              left;
+} flz_reader;
+
+static uint32_t
+flz_get(flz_reader *r)
+{
+  while (r->off == r->iov[r->idx].iov_len)
+    {
+      r->idx++;
+      r->off = 0;
+    }
+
+  r->left--;
+  return ((const uint8_t *)r->iov[r->idx].iov_base )[r->off++];
+}
+
+/*
+ * fastlz_decompress is the reference. A block in one buffer is decoded
+ * from the sequences of fastlz_parse, which has the same rules; a block
+ * split across buffers is read a byte at a time, with the checks of
+ * flz_parse in fastlz.c in the same order, so that both accept the same
+ * blocks, trailing bytes included, and decode them the same.
+ */
+
+int
+fastlz_decompress_iov(const struct iovec *iov, int iovcnt,
+                      const struct iovec *out, int outcnt)
+{
+  flz_reader  r;
+  flz_writer  w;
+  flz_cursor  ref_cursor;
+  uint32_t    length, maxout;
+  uint32_t    ctrl, end;
+  int         level;
+  int         overflow;
+
+  length = flz_total(iov, iovcnt, &overflow);
+  if (overflow)
+    {
+      return FASTLZ_ERROR_CORRUPT;
+    }
+
+  maxout = flz_total(out, outcnt, &overflow);
+  if (overflow)
+    {
+      maxout = 0x7fffffff;
+    }
+
+  if (iovcnt == 1 && outcnt == 1)
+    {
+      return fastlz_decompress(iov[0].iov_base, length, out[0].iov_base,
+                               maxout);
+    }
+
+  if (length == 0)
+    {
+      return FASTLZ_ERROR_TOO_SMALL;
+    }
+
+  flz_writer_init(&w, out, outcnt);
+  flz_cursor_init(&ref_cursor, out, outcnt);
+  if (iovcnt == 1)
+    {
+      return flz_decompress_parsed((const uint8_t *)iov[0].iov_base, length,
+                                   &w, &ref_cursor, maxout);
+    }
+
+  memset(&r, 0, sizeof( r ));
+  r.iov   = iov;
+  r.cnt   = iovcnt;
+  r.left  = length;
+
+  ctrl   = flz_get(&r);
+  level  = ( ctrl >> 5 ) + 1;
+  if (level != 1 && level != 2)
+    {
+      return FASTLZ_ERROR_UNKNOWN_LEVEL;
+    }
+
+  /* The block ends when less than its smallest instruction is left */
+  end    = level == 1 ? 2 : 1;
+  ctrl  &= 31;
+  for (;;)
+    {
+      if (ctrl >= 32)
+        {
+          uint32_t  len  = ( ctrl >> 5 ) - 1;
+          uint32_t  ofs  = ( ctrl & 31 ) << 8;
+          uint32_t  code;
+
+          if (len == 7 - 1)
+            {
+              do
+                {
+                  if (r.left == 0)
+                    {
+                      return FASTLZ_ERROR_CORRUPT;
+                    }
+
+                  code   = flz_get(&r);
+                  len   += code;
+                }
+              while (level == 2 && code == 255);
+            }
+
+          if (r.left == 0)
+            {
+              return FASTLZ_ERROR_CORRUPT;
+            }
+
+          code   = flz_get(&r);
+          len   += 3;
+
+          /* match from 16-bit distance, which never ends a block */
+          if (level == 2 && code == 255 && ofs == ( 31 << 8 ))
+            {
+              if (r.left < 3)
+                {
+                  return FASTLZ_ERROR_CORRUPT;
+                }
+
+              ofs   = flz_get(&r) << 8;
+              ofs  += flz_get(&r);
+              ofs  += MAX_L2_DISTANCE;
+            }
+          else
+            {
+              ofs += code;
+            }
+
+          if (len > maxout - FLZ_TOTAL(&w))
+            {
+              return FASTLZ_ERROR_TOO_SMALL;
+            }
+
+          if (ofs >= FLZ_TOTAL(&w))
+            {
+              return FASTLZ_ERROR_CORRUPT;
+            }
+
+          flz_put_match(&w, &ref_cursor, len, ofs + 1);
+        }
+      else
+        {
+          ctrl++;
+          if (ctrl > maxout - FLZ_TOTAL(&w))
+            {
+              return FASTLZ_ERROR_TOO_SMALL;
+            }
+
+          if (ctrl > r.left)
+            {
+              return FASTLZ_ERROR_CORRUPT;
+            }
+
+          while (ctrl > 0)
+            {
+              size_t n;
+
+              while (r.off == r.iov[r.idx].iov_len)
+                {
+                  r.idx++;
+                  r.off = 0;
+                }
+
+              n = r.iov[r.idx].iov_len - r.off;
+              n = n < ctrl ? n : ctrl;
+              flz_put(&w, (const uint8_t *)r.iov[r.idx].iov_base + r.off, n);
+              r.off   += n;
+              r.left  -= n;
+              ctrl    -= n;
+            }
+        }
+
+      if (r.left < end)
+        {
+          break;
+        }
+
+      ctrl = flz_get(&r);
+    }
+
+  return (int)FLZ_TOTAL(&w);
+}
+
+/* Matches shorter than this are copied rather than referenced */
+#define FLZ_REF_MIN_MATCH 16
+
+typedef struct flz_refs
+{
+  struct iovec *  iov;
+  int             cnt;
+  int             max;
+  uint32_t        total;    /* logical size described by iov */
+  uint8_t *       scratch;
+  uint32_t        used;
+  uint32_t        room;
+} flz_refs;
+
+static int
+flz_ref_add(flz_refs *r, const uint8_t *p, uint32_t len)
+{
+  struct iovec *last = r->cnt > 0 ? &r->iov[r->cnt - 1] : NULL;
+
+  if (last && (const uint8_t *)last->iov_base + last->iov_len == p)
+    {
+      last->iov_len += len;
+    }
+  else
+    {
+      if (r->cnt == r->max)
+        {
+          return FASTLZ_ERROR_TOO_SMALL;
+        }
+
+      r->iov[r->cnt].iov_base  = (void *)p;
+      r->iov[r->cnt].iov_len   = len;
+      r->cnt++;
+    }
+
+  r->total += len;
+  return 0;
+}
+
+/* Reference holding logical offset pos, searching back from the end */
+static int
+flz_ref_find(const flz_refs *r, uint32_t pos, uint32_t *offset)
+{
+  uint32_t  start  = r->total;
+  int       i      = r->cnt;
+
+  do
+    {
+      --i;
+      start -= (uint32_t)r->iov[i].iov_len;
+    }
+  while (start > pos);
+
+  *offset = pos - start;
+  return i;
+}
+
+static int
+flz_ref_match(flz_refs *r, uint32_t len, uint32_t distance)
+{
+  uint32_t  pos  = r->total - distance;
+  uint32_t  offset, n;
+  int       i    = flz_ref_find(r, pos, &offset);
+
+  if (len >= FLZ_REF_MIN_MATCH && len <= distance)
+    {
+      /* Repeat the pieces the source is made of */
+      while (len > 0)
+        {
+          n  = (uint32_t)r->iov[i].iov_len - offset;
+          n  = n < len ? n : len;
+          if (flz_ref_add(r, (const uint8_t *)r->iov[i].iov_base + offset, n)
+              < 0)
+            {
+              return FASTLZ_ERROR_TOO_SMALL;
+            }
+
+          len     -= n;
+          offset   = 0;
+          i++;
+        }
+    }
+  else
+    {
+      uint8_t * dst = r->scratch + r->used;
+      uint32_t  copied;
+
+      if (len > r->room - r->used)
+        {
+          return FASTLZ_ERROR_TOO_SMALL;
+        }
+
+      /* Gather what exists of the source, then repeat it for overlaps */
+      n       = len < distance ? len : distance;
+      copied  = 0;
+      while (copied < n)
+        {
+          uint32_t avail = (uint32_t)r->iov[i].iov_len - offset;
+
+          avail = avail < n - copied ? avail : n - copied;
+          memcpy(dst + copied, (const uint8_t *)r->iov[i].iov_base + offset,
+                 avail);
+          copied  += avail;
+          offset   = 0;
+          i++;
+        }
+
+      for (; copied < len; copied++)
+        {
+          dst[copied] = dst[copied - distance];
+        }
+
+      r->used += len;
+      return flz_ref_add(r, dst, len);
+    }
+
+  return 0;
+}
+
+int
+fastlz_decompress_refs(const void *input, int length, struct iovec *refs,
+                       int *nrefs, void *scratch, int maxscratch, int maxout)
+{
+  const uint8_t *  ip = (const uint8_t *)input;
+  fastlz_parser    parser;
+  fastlz_sequence  seq[FLZ_SEQ_BATCH];
+  flz_refs         r;
+  int              count, i;
+
+  if (length <= 0 || *nrefs < 0 || maxscratch < 0 || maxout < 0)
+    {
+      return FASTLZ_ERROR_TOO_SMALL;
+    }
+
+  memset(&r, 0, sizeof( r ));
+  r.iov      = refs;
+  r.max      = *nrefs;
+  r.scratch  = (uint8_t *)scratch;
+  r.room     = (uint32_t)maxscratch;
+  *nrefs     = 0;
+
+  /* The sequences are checked by fastlz_parse, as for fastlz_decompress */
+  memset(&parser, 0, sizeof( parser ));
+  while (( count = fastlz_parse(&parser, ip, length, seq, FLZ_SEQ_BATCH))
+         > 0)
+    {
+      for (i = 0; i < count; i++)
+        {
+          const fastlz_sequence * s = &seq[i];
+
+          if (s->literal_length + s->match_length > (uint32_t)maxout - r.total)
+            {
+              return FASTLZ_ERROR_TOO_SMALL;
+            }
+
+          if (( s->literal_length > 0
+                && flz_ref_add(&r, ip + s->literal, s->literal_length) < 0 )
+              || ( s->match_length > 0
+                   && flz_ref_match(&r, s->match_length, s->distance) < 0 ))
+            {
+              return FASTLZ_ERROR_TOO_SMALL;
+            }
+        }
+    }
+
+  if (count < 0)
+    {
+      return count;
+    }
+
+  *nrefs = r.cnt;
+  return (int)r.total;
+}
@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * FastLZ - Byte-aligned LZ77 compression library
+ *
+ * Copyright (c) 2005-2020 Ariya Hidayat <ariya.hidayat@gmail.com>
+ * Copyright (c) 2023 Jeffrey H. Johnson <trnsz@pobox.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ *  * The above copyright notice and this permission notice shall be
+ *    included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FASTLZ_IOV_H
+# define FASTLZ_IOV_H
+
+# include <sys/uio.h>
+
+# if defined( __cplusplus )
+  extern "C"
+  {
+# endif /* if defined( __cplusplus ) */
+
+/*
+ * Compress scattered data into scattered buffers
+ *
+ * The input is the concatenation of the iovcnt buffers of iov, and the
+ * compressed block is written across the outcnt buffers of out, in order,
+ * filling each one before moving to the next. The result is a regular
+ * compressed block: it can be decompressed with fastlz_decompress once
+ * gathered, or with fastlz_decompress_iov. Matches may refer to data in
+ * earlier buffers and may extend across buffer boundaries, so the ratio is
+ * the same as for contiguous input.
+ *
+ * The total output size must be at least FASTLZ_COMPRESS_BOUND of the
+ * total input size, otherwise FASTLZ_ERROR_TOO_SMALL may be returned.
+ * Empty buffers are allowed anywhere. The input and output buffers can not
+ * overlap.
+ *
+ * Parameters:
+ *
+ *                          level - compression level (1 or 2)
+ *                            iov - data to compress
+ *                         iovcnt - number of input buffers
+ *                            out - receive compressed data
+ *                         outcnt - number of output buffers
+ *                      workspace - FASTLZ_WORKSPACE_SIZE bytes of scratch
+ *
+ * Returns the size of the compressed block, or:
+ *
+ *           FASTLZ_ERROR_CORRUPT - data could not be encoded
+ *         FASTLZ_ERROR_TOO_SMALL - input or output buffer is too small
+ *     FASTLZ_ERROR_UNKNOWN_LEVEL - level not one or two
+ */
+
+int fastlz_compress_iov(int level, const struct iovec *iov, int iovcnt,
+                        const struct iovec *out, int outcnt,
+                        void *workspace);
+
+/*
+ * Compress a region of a ring buffer
+ *
+ * The region starts at offset start of the ring of capacity bytes and
+ * continues at the beginning of the ring when it reaches the end, so a
+ * region that wraps around does not have to be copied to a linear buffer
+ * first. Matches may refer across the wrap.
+ *
+ * The output buffer must be at least FASTLZ_COMPRESS_BOUND(length) bytes.
+ *
+ * Parameters:
+ *
+ *                          level - compression level (1 or 2)
+ *                           ring - start of the ring buffer
+ *                       capacity - size of the ring buffer
+ *                          start - offset of the region in the ring
+ *                         length - length of the region, up to capacity
+ *                         output - receive compressed data
+ *                      workspace - FASTLZ_WORKSPACE_SIZE bytes of scratch
+ *
+ * Returns the size of the compressed block, or:
+ *
+ *           FASTLZ_ERROR_CORRUPT - start or length out of range
+ *         FASTLZ_ERROR_TOO_SMALL - length is zero
+ *     FASTLZ_ERROR_UNKNOWN_LEVEL - level not one or two
+ */
+
+int fastlz_compress_ring(int level, const void *ring, int capacity,
+                         int start, int length, void *output,
+                         void *workspace);
+
+/*
+ * Decompress scattered data into scattered buffers
+ *
+ * The compressed block is the concatenation of the iovcnt buffers of iov.
+ * The decompressed data is written across the outcnt buffers of out, in
+ * order, filling each one before moving to the next.
+ *
+ * fastlz_decompress is the reference: this function accepts exactly the
+ * blocks it accepts, trailing bytes after the last instruction included,
+ * and gives the same result and the same error code. Contiguous input is
+ * parsed with fastlz_parse; scattered input is read byte by byte with the
+ * same checks in the same order.
+ *
+ * Parameters:
+ *
+ *                            iov - data to decompress
+ *                         iovcnt - number of input buffers
+ *                            out - receive decompressed data
+ *                         outcnt - number of output buffers
+ *
+ * Returns the size of the decompressed data, or:
+ *
+ *           FASTLZ_ERROR_CORRUPT - input is corrupt
+ *         FASTLZ_ERROR_TOO_SMALL - input or output buffer is too small
+ *     FASTLZ_ERROR_UNKNOWN_LEVEL - not a known compression level
+ */
+
+int fastlz_decompress_iov(const struct iovec *iov, int iovcnt,
+                          const struct iovec *out, int outcnt);
+
+/*
+ * Decompress a block to a list of references
+ *
+ * Instead of writing the decompressed data, fill refs with (pointer,
+ * length) pairs that, taken in order, make up the decompressed data, e.g.
+ * for writev. Literal runs point into the compressed input, and long
+ * matches point at the memory that already holds the earlier output they
+ * repeat. Short and self-overlapping matches are copied into scratch, and
+ * adjacent pieces are merged. The input and scratch must stay unchanged as
+ * long as the references are used. The block is parsed with fastlz_parse,
+ * so it is accepted or rejected exactly as by fastlz_decompress.
+ *
+ * This is meant for blocks that are mostly literals; for blocks that are
+ * mostly matches, fastlz_decompress is faster and gives fewer pieces.
+ *
+ * Parameters:
+ *
+ *                          input - data to decompress
+ *                         length - length of input
+ *                           refs - receive the references
+ *                          nrefs - on entry the size of refs, on return
+ *                                  the number of references filled in
+ *                        scratch - receive copies of matches
+ *                     maxscratch - size of scratch
+ *                         maxout - maximum size of the decompressed data
+ *
+ * Returns the size of the decompressed data, or:
+ *
+ *           FASTLZ_ERROR_CORRUPT - input is corrupt
+ *         FASTLZ_ERROR_TOO_SMALL - refs, scratch or maxout is too small
+ *     FASTLZ_ERROR_UNKNOWN_LEVEL - not a known compression level
+ */
+
+int fastlz_decompress_refs(const void *input, int length, struct iovec *refs,
+                           int *nrefs, void *scratch, int maxscratch,
+                           int maxout);
+
+# if defined( __cplusplus )
+  }
+# endif /* if defined( __cplusplus ) */
+
+#endif /* FASTLZ_IOV_H */
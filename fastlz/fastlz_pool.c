@@ -0,0 +1,408 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * FastLZ - Byte-aligned LZ77 compression library
+ *
+ * Copyright (c) 2005-2020 Ariya Hidayat <ariya.hidayat@gmail.com>
+ * Copyright (c) 2023 Jeffrey H. Johnson <trnsz@pobox.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ *  * The above copyright notice and this permission notice shall be
+ *    included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined( _POSIX_C_SOURCE )
+# define _POSIX_C_SOURCE 200112L
+#endif /* if !defined( _POSIX_C_SOURCE ) */
+
+#include "fastlz.h"
+#include "fastlz_pool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+/*
+ * Submission uses a lock-free stack per worker when the compiler provides
+ * atomic builtins; otherwise the pool mutex protects it.
+ */
+
+#if defined( __clang__ )                                 \
+  || ( defined( __GNUC__ ) && (( __GNUC__ > 4 )          \
+  || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 7 )))
+# define FLZ_POOL_ATOMICS
+#endif /* if defined( __clang__ )
+           || ( defined( __GNUC__ ) && (( __GNUC__ > 4 )
+           || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 7 ))) */
+
+typedef struct flz_worker
+{
+  fastlz_pool *  pool;
+  int            index;
+  pthread_t      thread;
+  fastlz_job *   incoming;
+  void *         workspace;
+} flz_worker;
+
+struct fastlz_pool
+{
+  int              threads;
+  int              started;
+  flz_worker *     workers;
+  unsigned int     next;
+  int              sleepers;
+  int              waiters;
+  int              stop;
+  pthread_mutex_t  lock;
+  pthread_cond_t   work_cond;
+  pthread_cond_t   done_cond;
+};
+
+#if defined( FLZ_POOL_ATOMICS )
+
+  static void
+  flz_push(fastlz_pool *pool, flz_worker *w, fastlz_job *job)
+  {
+    fastlz_job *head = __atomic_load_n(&w->incoming, __ATOMIC_RELAXED);
+
+    (void)pool;
+    do
+      {
+        job->next = head;
+      }
+    while (!__atomic_compare_exchange_n(&w->incoming, &head, job, 1,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+  }
+
+  static fastlz_job *
+  flz_take(fastlz_pool *pool, flz_worker *w)
+  {
+    (void)pool;
+    if (!__atomic_load_n(&w->incoming, __ATOMIC_RELAXED))
+      {
+        return NULL;
+      }
+
+    return __atomic_exchange_n(&w->incoming, NULL, __ATOMIC_SEQ_CST);
+  }
+
+  static int
+  flz_load(int *p)
+  {
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+  }
+
+  static void
+  flz_store(int *p, int v)
+  {
+    __atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+  }
+
+  static unsigned int
+  flz_next_worker(fastlz_pool *pool)
+  {
+    return __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+  }
+
+#else  /* if defined( FLZ_POOL_ATOMICS ) */
+
+  static void
+  flz_push(fastlz_pool *pool, flz_worker *w, fastlz_job *job)
+  {
+    pthread_mutex_lock(&pool->lock);
+    job->next    = w->incoming;
+    w->incoming  = job;
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  static fastlz_job *
+  flz_take(fastlz_pool *pool, flz_worker *w)
+  {
+    fastlz_job *head;
+
+    pthread_mutex_lock(&pool->lock);
+    head         = w->incoming;
+    w->incoming  = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    return head;
+  }
+
+  static int
+  flz_load(int *p)
+  {
+    return *(volatile int *)p;
+  }
+
+  static void
+  flz_store(int *p, int v)
+  {
+    *(volatile int *)p = v;
+  }
+
+  static unsigned int
+  flz_next_worker(fastlz_pool *pool)
+  {
+    return pool->next++;
+  }
+
+#endif /* if defined( FLZ_POOL_ATOMICS ) */
+
+static int
+flz_pending(fastlz_pool *pool)
+{
+  int i;
+
+  for (i = 0; i < pool->threads; i++)
+    {
+#if defined( FLZ_POOL_ATOMICS )
+        if (__atomic_load_n(&pool->workers[i].incoming, __ATOMIC_SEQ_CST))
+#else  /* if defined( FLZ_POOL_ATOMICS ) */
+        if (pool->workers[i].incoming)
+#endif /* if defined( FLZ_POOL_ATOMICS ) */
+        {
+          return 1;
+        }
+    }
+
+  return 0;
+}
+
+static void
+flz_run_job(fastlz_pool *pool, fastlz_job *job, void *workspace)
+{
+  if (job->op == FASTLZ_JOB_COMPRESS)
+    {
+      job->result = fastlz_compress_workspace(job->level, job->input,
+                                              job->length, job->output,
+                                              workspace);
+    }
+  else
+    {
+      job->result = fastlz_decompress(job->input, job->length, job->output,
+                                      job->maxout);
+    }
+
+  if (job->callback)
+    {
+      job->callback(job);
+    }
+
+  /* The job belongs to the caller again once done is set */
+#if defined( FLZ_POOL_ATOMICS )
+    flz_store(&job->done, 1);
+    if (flz_load(&pool->waiters) > 0)
+      {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->done_cond);
+        pthread_mutex_unlock(&pool->lock);
+      }
+
+#else  /* if defined( FLZ_POOL_ATOMICS ) */
+    pthread_mutex_lock(&pool->lock);
+    job->done = 1;
+    pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->lock);
+#endif /* if defined( FLZ_POOL_ATOMICS ) */
+}
+
+static void *
+flz_worker_main(void *arg)
+{
+  flz_worker *   w     = (flz_worker *)arg;
+  fastlz_pool *  pool  = w->pool;
+
+  for (;;)
+    {
+      fastlz_job *  batch;
+      fastlz_job *  fifo;
+      int           i;
+
+      /* Own jobs first, then steal the queue of a busy worker */
+      batch = flz_take(pool, w);
+      for (i = 1; !batch && i < pool->threads; i++)
+        {
+          batch = flz_take(pool, &pool->workers[( w->index + i )
+                                                % pool->threads]);
+        }
+
+      if (!batch)
+        {
+          pthread_mutex_lock(&pool->lock);
+          if (pool->stop && !flz_pending(pool))
+            {
+              pthread_mutex_unlock(&pool->lock);
+              break;
+            }
+
+          flz_store(&pool->sleepers, pool->sleepers + 1);
+          if (!pool->stop && !flz_pending(pool))
+            {
+              pthread_cond_wait(&pool->work_cond, &pool->lock);
+            }
+
+          flz_store(&pool->sleepers, pool->sleepers - 1);
+          pthread_mutex_unlock(&pool->lock);
+          continue;
+        }
+
+      /* The stack is in reverse submission order */
+      fifo = NULL;
+      while (batch)
+        {
+          fastlz_job *job = batch;
+          batch      = job->next;
+          job->next  = fifo;
+          fifo       = job;
+        }
+
+      while (fifo)
+        {
+          fastlz_job *job = fifo;
+          fifo = job->next;
+          flz_run_job(pool, job, w->workspace);
+        }
+    }
+
+  return NULL;
+}
+
+fastlz_pool *
+fastlz_pool_create(int threads)
+{
+  fastlz_pool *  pool;
+  int            i;
+
+  if (threads < 1 || threads > FASTLZ_POOL_MAX_THREADS)
+    {
+      return NULL;
+    }
+
+  pool = (fastlz_pool *)calloc(1, sizeof( fastlz_pool ));
+  if (!pool)
+    {
+      return NULL;
+    }
+
+  pool->workers = (flz_worker *)calloc(threads, sizeof( flz_worker ));
+  if (!pool->workers)
+    {
+      free(pool);
+      return NULL;
+    }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+
+  pool->threads = threads;
+  for (i = 0; i < threads; i++)
+    {
+      flz_worker *w = &pool->workers[i];
+
+      w->pool       = pool;
+      w->index      = i;
+      w->workspace  = malloc(FASTLZ_WORKSPACE_SIZE);
+      if (!w->workspace
+          || pthread_create(&w->thread, NULL, flz_worker_main, w) != 0)
+        {
+          free(w->workspace);
+          break;
+        }
+
+      pool->started = i + 1;
+    }
+
+  if (pool->started != threads)
+    {
+      fastlz_pool_destroy(pool);
+      return NULL;
+    }
+
+  return pool;
+}
+
+int
+fastlz_pool_submit(fastlz_pool *pool, fastlz_job *job)
+{
+  flz_worker *w;
+
+  if (job->op != FASTLZ_JOB_COMPRESS && job->op != FASTLZ_JOB_DECOMPRESS)
+    {
+      return FASTLZ_ERROR_CORRUPT;
+    }
+
+  job->done  = 0;
+  w          = &pool->workers[flz_next_worker(pool) % pool->threads];
+  flz_push(pool, w, job);
+
+  if (flz_load(&pool->sleepers) > 0)
+    {
+      pthread_mutex_lock(&pool->lock);
+      pthread_cond_signal(&pool->work_cond);
+      pthread_mutex_unlock(&pool->lock);
+    }
+
+  return 0;
+}
+
+int
+fastlz_pool_wait(fastlz_pool *pool, fastlz_job *job)
+{
+  if (!flz_load(&job->done))
+    {
+      pthread_mutex_lock(&pool->lock);
+      flz_store(&pool->waiters, pool->waiters + 1);
+      while (!flz_load(&job->done))
+        {
+          pthread_cond_wait(&pool->done_cond, &pool->lock);
+        }
+
+      flz_store(&pool->waiters, pool->waiters - 1);
+      pthread_mutex_unlock(&pool->lock);
+    }
+
+  return job->result;
+}
+
+void
+fastlz_pool_destroy(fastlz_pool *pool)
+{
+  int i;
+
+  if (!pool)
+    {
+      return;
+    }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < pool->started; i++)
+    {
+      pthread_join(pool->workers[i].thread, NULL);
+      free(pool->workers[i].workspace);
+    }
+
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->workers);
+  free(pool);
+}
@@ -0,0 +1,131 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * FastLZ - Byte-aligned LZ77 compression library
+ *
+ * Copyright (c) 2005-2020 Ariya Hidayat <ariya.hidayat@gmail.com>
+ * Copyright (c) 2023 Jeffrey H. Johnson <trnsz@pobox.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ *  * The above copyright notice and this permission notice shall be
+ *    included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FASTLZ_POOL_H
+# define FASTLZ_POOL_H
+
+# define FASTLZ_JOB_COMPRESS          1
+# define FASTLZ_JOB_DECOMPRESS        2
+
+# define FASTLZ_POOL_MAX_THREADS      256
+
+# if defined( __cplusplus )
+  extern "C"
+  {
+# endif /* if defined( __cplusplus ) */
+
+typedef struct fastlz_pool fastlz_pool;
+typedef struct fastlz_job  fastlz_job;
+
+/*
+ * A compression or decompression request
+ *
+ * Fill in the public fields and pass the job to fastlz_pool_submit. The job
+ * and both buffers must stay valid until it is completed, i.e. until the
+ * callback ran or fastlz_pool_wait returned. Jobs can be reused afterwards.
+ *
+ * Fields:
+ *
+ *                             op - FASTLZ_JOB_COMPRESS or _DECOMPRESS
+ *                          level - compression level (compression only)
+ *                          input - data to (de)compress
+ *                         length - length of input
+ *                         output - receives the result
+ *                         maxout - size of output (decompression only)
+ *                       callback - optional, called on the worker thread
+ *                                  once the job is done
+ *                           user - free for the caller
+ *                         result - return value of fastlz_compress_level
+ *                                  or fastlz_decompress
+ */
+
+struct fastlz_job
+{
+  int           op;
+  int           level;
+  const void *  input;
+  int           length;
+  void *        output;
+  int           maxout;
+  void          ( *callback )(fastlz_job *job);
+  void *        user;
+  int           result;
+
+  /* Private */
+  fastlz_job *  next;
+  int           done;
+};
+
+/*
+ * Create a pool of worker threads
+ *
+ * Each worker keeps its own compression workspace for the lifetime of the
+ * pool, so requests do not pay for the 64 KB match finder table on their
+ * own stack. Jobs are queued without locking and each worker takes all of
+ * its pending jobs at once, handling small requests in batches.
+ *
+ * Returns the pool, or NULL if threads is out of range (1 to
+ * FASTLZ_POOL_MAX_THREADS) or the pool can not be created.
+ */
+
+fastlz_pool *fastlz_pool_create(int threads);
+
+/*
+ * Queue a job
+ *
+ * Can be called from any thread, including from a callback.
+ *
+ * Returns:
+ *
+ *                              0 - job is queued
+ *           FASTLZ_ERROR_CORRUPT - job->op is not a known operation
+ */
+
+int fastlz_pool_submit(fastlz_pool *pool, fastlz_job *job);
+
+/*
+ * Wait for a submitted job to complete (after its callback, if any)
+ *
+ * Returns job->result.
+ */
+
+int fastlz_pool_wait(fastlz_pool *pool, fastlz_job *job);
+
+/*
+ * Stop the workers and free the pool
+ *
+ * Jobs already submitted are completed first.
+ */
+
+void fastlz_pool_destroy(fastlz_pool *pool);
+
+# if defined( __cplusplus )
+  }
+# endif /* if defined( __cplusplus ) */
+
+#endif /* FASTLZ_POOL_H */
@@ -0,0 +1,558 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * FastLZ - Byte-aligned LZ77 compression library
+ *
+ * Copyright (c) 2005-2020 Ariya Hidayat <ariya.hidayat@gmail.com>
+ * Copyright (c) 2023 Jeffrey H. Johnson <trnsz@pobox.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ *  * The above copyright notice and this permission notice shall be
+ *    included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * std::streambuf adapters for FastLZ compressed streams
+ *
+ * The stream uses the 6pack layout: the 8-byte 6pack magic followed by
+ * chunks with a 16-byte header (id, options, size, Adler-32 checksum, extra).
+ * Each block of data is one chunk 17, compressed (options 1) or stored
+ * (options 0), with extra holding the uncompressed size. fastlz::istreambuf
+ * skips every other chunk, so it can also read the content of a 6pack
+ * archive.
+ *
+ * Data is moved in whole blocks: writes or reads of at least one block go
+ * straight between the caller's memory and the codec, without passing
+ * through the internal buffers.
+ */
+
+#ifndef FASTLZ_STREAM_HPP
+# define FASTLZ_STREAM_HPP
+
+# include "fastlz.hpp"
+
+# include <stdexcept>
+# include <streambuf>
+
+namespace fastlz
+{
+
+  namespace detail
+  {
+
+    const unsigned char sixpack_magic[8] = {
+      137, '6', 'P', 'K', 13, 10, 26, 10
+    };
+
+    /* Largest block accepted by default, the largest 6pack -B allows */
+    const std::size_t block_limit = 67108864;
+
+    /* Block size of an ostreambuf, from 1 to block_limit bytes */
+    inline std::size_t
+    check_block_size(std::size_t block_size)
+    {
+      if (block_size == 0 || block_size > block_limit)
+        {
+          throw std::invalid_argument("fastlz::ostreambuf: bad block size");
+        }
+
+      return block_size;
+    }
+
+    /* Adler-32 checksum algorithm; see RFC-1950, Section 8.2 */
+    inline unsigned long
+    update_adler32(unsigned long checksum, const void *buf, std::size_t len)
+    {
+      const unsigned char * ptr  = (const unsigned char *)buf;
+      unsigned long         s1   = checksum & 0xffff;
+      unsigned long         s2   = ( checksum >> 16 ) & 0xffff;
+
+      while (len > 0)
+        {
+          std::size_t k = len < 5552 ? len : 5552;
+          len -= k;
+          while (k-- > 0)
+            {
+              s1  += *ptr++;
+              s2  += s1;
+            }
+          s1  = s1 % 65521;
+          s2  = s2 % 65521;
+        }
+      return ( s2 << 16 ) + s1;
+    }
+
+    inline void
+    write_u32(unsigned char *p, unsigned long v)
+    {
+      p[0]  = v & 255;
+      p[1]  = ( v >> 8 ) & 255;
+      p[2]  = ( v >> 16 ) & 255;
+      p[3]  = ( v >> 24 ) & 255;
+    }
+
+    inline unsigned long
+    read_u32(const unsigned char *p)
+    {
+      return p[0] + ( p[1] << 8 ) + ( p[2] << 16 )
+             + ((unsigned long)p[3] << 24 );
+    }
+
+    /*
+     * Encode one block as a chunk 17 into out, which must hold
+     * 16 + compress_bound(size) bytes. Blocks that are too small or not
+     * compressible are stored as is, like 6pack does. Returns the size of
+     * the chunk including its header.
+     */
+
+    inline std::size_t
+    encode_chunk(context &ctx, const void *data, std::size_t size,
+                 unsigned char *out)
+    {
+      int            options  = 1;
+      int            chunk_size;
+      unsigned long  checksum;
+
+      chunk_size = size < 32 ? -1
+                   : compress(ctx, byte_view((const std::byte *)data, size),
+                              byte_span((std::byte *)out + 16,
+                                        compress_bound(size)));
+      if (chunk_size <= 0 || (std::size_t)chunk_size >= size)
+        {
+          options     = 0;
+          chunk_size  = (int)size;
+          std::memcpy(out + 16, data, size);
+        }
+
+      checksum = update_adler32(1L, out + 16, chunk_size);
+
+      out[0]  = 17;
+      out[1]  = 0;
+      out[2]  = options;
+      out[3]  = 0;
+      write_u32(out + 4, chunk_size);
+      write_u32(out + 8, checksum);
+      write_u32(out + 12, size);
+
+      return 16 + chunk_size;
+    }
+
+  } /* namespace detail */
+
+  /*
+   * Output adapter: everything written is compressed in blocks of
+   * block_size bytes and written to the sink, which must outlive this
+   * object. Partial blocks are flushed by pubsync() and on destruction.
+   * Throws std::invalid_argument unless block_size is from 1 byte to
+   * detail::block_limit, the largest block istreambuf reads by default.
+   */
+
+  class ostreambuf : public std::streambuf
+  {
+  public:
+    explicit ostreambuf(std::streambuf *sink, int level = 1,
+                        std::size_t block_size = 65536)
+      : sink_(sink), ctx_(level),
+        block_size_(detail::check_block_size(block_size)),
+        block_(block_size), result_(16 + compress_bound(block_size)),
+        failed_(false)
+    {
+      char *begin = (char *)block_.data();
+      setp(begin, begin + block_size_);
+      put((const unsigned char *)detail::sixpack_magic, 8);
+    }
+
+    ~ostreambuf() override { flush_block(); }
+
+    /* True once writing to the sink failed */
+    bool failed() const noexcept { return failed_; }
+
+  protected:
+    int_type
+    overflow(int_type c) override
+    {
+      if (!flush_block())
+        {
+          return traits_type::eof();
+        }
+
+      if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+          *pptr() = traits_type::to_char_type(c);
+          pbump(1);
+        }
+
+      return traits_type::not_eof(c);
+    }
+
+    std::streamsize
+    xsputn(const char *s, std::streamsize n) override
+    {
+      std::streamsize done = 0;
+
+      while (done < n)
+        {
+          std::size_t room  = epptr() - pptr();
+          std::size_t left  = (std::size_t)( n - done );
+
+          /* Whole blocks bypass the put area */
+          if (pptr() == pbase() && left >= block_size_)
+            {
+              if (!write_block(s + done, block_size_))
+                {
+                  break;
+                }
+
+              done += block_size_;
+              continue;
+            }
+
+          std::size_t count = left < room ? left : room;
+          std::memcpy(pptr(), s + done, count);
+          pbump((int)count);
+          done += count;
+          if (pptr() == epptr() && !flush_block())
+            {
+              break;
+            }
+        }
+
+      return done;
+    }
+
+    int
+    sync() override
+    {
+      if (!flush_block())
+        {
+          return -1;
+        }
+
+      return sink_->pubsync();
+    }
+
+  private:
+    bool
+    put(const unsigned char *data, std::size_t size)
+    {
+      if (!failed_
+          && sink_->sputn((const char *)data, size) != (std::streamsize)size)
+        {
+          failed_ = true;
+        }
+
+      return !failed_;
+    }
+
+    bool
+    flush_block()
+    {
+      std::size_t size = pptr() - pbase();
+
+      if (size == 0)
+        {
+          return !failed_;
+        }
+
+      setp(pbase(), epptr());
+      return write_block(pbase(), size);
+    }
+
+    bool
+    write_block(const char *data, std::size_t size)
+    {
+      unsigned char *out = (unsigned char *)result_.data();
+
+      return put(out, detail::encode_chunk(ctx_, data, size, out));
+    }
+
+    std::streambuf *  sink_;
+    context           ctx_;
+    std::size_t       block_size_;
+    buffer            block_;
+    buffer            result_;
+    bool              failed_;
+  };
+
+  /*
+   * Input adapter: reads a stream written by fastlz::ostreambuf (or a
+   * 6pack archive) from the source, which must outlive this object. A
+   * corrupted stream ends the input and sets failed(), as does a block
+   * larger than max_block, so that a hostile header can not make it
+   * allocate more than about twice that.
+   */
+
+  class istreambuf : public std::streambuf
+  {
+  public:
+    explicit istreambuf(std::streambuf *source,
+                        std::size_t max_block = detail::block_limit)
+      : source_(source), max_block_(max_block), started_(false),
+        failed_(false), pending_(0), decoded_(0)
+    {
+      setg(nullptr, nullptr, nullptr);
+    }
+
+    /* True if the stream is not a valid FastLZ stream */
+    bool failed() const noexcept { return failed_; }
+
+  protected:
+    int_type
+    underflow() override
+    {
+      if (gptr() < egptr())
+        {
+          return traits_type::to_int_type(*gptr());
+        }
+
+      if (!next_chunk())
+        {
+          return traits_type::eof();
+        }
+
+      block_.clear();
+      block_.reserve(pending_);
+      if (!decode((std::byte *)block_.data()))
+        {
+          return traits_type::eof();
+        }
+
+      block_.resize(decoded_);
+
+      char *begin = (char *)block_.data();
+      setg(begin, begin, begin + block_.size());
+      return traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize
+    xsgetn(char *s, std::streamsize n) override
+    {
+      std::streamsize done = 0;
+
+      while (done < n)
+        {
+          std::size_t avail = egptr() - gptr();
+          if (avail)
+            {
+              std::size_t count
+                = avail < (std::size_t)( n - done )
+                    ? avail : (std::size_t)( n - done );
+              std::memcpy(s + done, gptr(), count);
+              gbump((int)count);
+              done += count;
+              continue;
+            }
+
+          if (!next_chunk())
+            {
+              break;
+            }
+
+          /* Whole blocks are decoded straight into the caller's memory */
+          if (pending_ <= (std::size_t)( n - done ))
+            {
+              if (!decode((std::byte *)( s + done )))
+                {
+                  break;
+                }
+
+              done += decoded_;
+              continue;
+            }
+
+          if (underflow() == traits_type::eof())
+            {
+              break;
+            }
+        }
+
+      return done;
+    }
+
+  private:
+    bool
+    fail()
+    {
+      failed_ = true;
+      return false;
+    }
+
+    bool
+    get(void *data, std::size_t size)
+    {
+      return source_->sgetn((char *)data, size) == (std::streamsize)size;
+    }
+
+    /* Pass over size bytes of the source, seeking if it can */
+    bool
+    skip(unsigned long size)
+    {
+      char  scratch[4096];
+
+      if (source_->pubseekoff((std::streamoff)size, std::ios_base::cur,
+                              std::ios_base::in) != std::streampos(-1))
+        {
+          return true;
+        }
+
+      while (size > 0)
+        {
+          std::size_t count = size < sizeof( scratch ) ? size
+                                                       : sizeof( scratch );
+          if (!get(scratch, count))
+            {
+              return false;
+            }
+
+          size -= count;
+        }
+
+      return true;
+    }
+
+    /* Load the next chunk 17 into chunk_, leaving its size in pending_ */
+    bool
+    next_chunk()
+    {
+      unsigned char header[16];
+
+      if (failed_)
+        {
+          return false;
+        }
+
+      if (pending_)
+        {
+          return true;
+        }
+
+      if (!started_)
+        {
+          started_ = true;
+          if (!get(header, 8)
+              || std::memcmp(header, detail::sixpack_magic, 8) != 0)
+            {
+              return fail();
+            }
+        }
+
+      for (;;)
+        {
+          std::streamsize got = source_->sgetn((char *)header, 16);
+          if (got == 0)
+            {
+              return false;
+            }
+
+          if (got != 16)
+            {
+              return fail();
+            }
+
+          unsigned long size = detail::read_u32(header + 4);
+          if (header[0] != 17 || header[1] != 0)
+            {
+              if (!skip(size))
+                {
+                  return fail();
+                }
+
+              continue;
+            }
+
+          /* Checked before anything is allocated for the chunk */
+          unsigned long extra = detail::read_u32(header + 12);
+          if (extra > max_block_ || size > compress_bound(max_block_))
+            {
+              return fail();
+            }
+
+          chunk_.resize(size);
+          if (!get(chunk_.data(), size))
+            {
+              return fail();
+            }
+
+          options_   = header[2] + ( header[3] << 8 );
+          checksum_  = detail::read_u32(header + 8);
+          pending_   = extra;
+          if (pending_ == 0)
+            {
+              continue;
+            }
+
+          return true;
+        }
+    }
+
+    /* Decode the loaded chunk into out, which holds at least pending_ */
+    bool
+    decode(std::byte *out)
+    {
+      std::size_t size = pending_;
+
+      pending_ = 0;
+      if (detail::update_adler32(1L, chunk_.data(), chunk_.size())
+          != checksum_)
+        {
+          return fail();
+        }
+
+      switch (options_)
+        {
+        case 0:
+          if (chunk_.size() != size)
+            {
+              return fail();
+            }
+
+          std::memcpy(out, chunk_.data(), size);
+          break;
+
+        case 1:
+          if (decompress(chunk_.view(), byte_span(out, size))
+              != (int)size)
+            {
+              return fail();
+            }
+
+          break;
+
+        default:
+          return fail();
+        }
+
+      decoded_ = size;
+      return true;
+    }
+
+    std::streambuf *  source_;
+    std::size_t       max_block_;
+    bool              started_;
+    bool              failed_;
+    int               options_;
+    unsigned long     checksum_;
+    std::size_t       pending_;
+    std::size_t       decoded_;
+    buffer            chunk_;
+    buffer            block_;
+  };
+
+} /* namespace fastlz */
+
+#endif /* FASTLZ_STREAM_HPP */